@@ -0,0 +1,167 @@
+#include <math.h>
+#include <algorithm>
+#include "gds_aliases.h"
+
+using namespace gdstk;
+
+// Polygons of the cell with its paths converted (the converted ones are also in owned)
+static void cellPolygons(const Cell *cell, Array<Polygon *> &polygons, Array<Polygon *> &owned)
+{
+    polygons.count = 0;
+    owned.count = 0;
+    for (uint64_t i = 0; i < cell->polygon_array.count; i++)
+        polygons.append(cell->polygon_array[i]);
+
+    const uint64_t paths_begin = polygons.count;
+    for (uint64_t i = 0; i < cell->flexpath_array.count; i++)
+        cell->flexpath_array[i]->to_polygons(false, 0, polygons);
+    for (uint64_t i = 0; i < cell->robustpath_array.count; i++)
+        cell->robustpath_array[i]->to_polygons(false, 0, polygons);
+    for (uint64_t i = paths_begin; i < polygons.count; i++)
+        owned.append(polygons[i]);
+}
+
+static void freeOwned(Array<Polygon *> &owned)
+{
+    for (uint64_t i = 0; i < owned.count; i++)
+    {
+        owned[i]->clear();
+        free_allocation(owned[i]);
+    }
+    owned.count = 0;
+}
+
+// Min of the polygons points. Returns false without points
+static bool polygonsOrigin(const Array<Polygon *> &polygons, Vec2 &origin)
+{
+    bool found = false;
+    for (uint64_t i = 0; i < polygons.count; i++)
+    {
+        const Array<Vec2> &points = polygons[i]->point_array;
+        for (uint64_t k = 0; k < points.count; k++)
+        {
+            if (!found)
+                origin = points[k];
+            origin.x = std::min(origin.x, points[k].x);
+            origin.y = std::min(origin.y, points[k].y);
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Calls visit with the values that describe the polygons: tag, points relative to origin and repetition offsets, as
+// integer steps
+template <class F>
+static void visitPolygons(const Array<Polygon *> &polygons, const Vec2 &origin, double step, F visit)
+{
+    thread_local Array<Vec2> offsets = {};
+
+    visit((int64_t)polygons.count);
+    for (uint64_t i = 0; i < polygons.count; i++)
+    {
+        const Polygon *poly = polygons[i];
+        visit((int64_t)poly->tag);
+        visit((int64_t)poly->point_array.count);
+        for (uint64_t k = 0; k < poly->point_array.count; k++)
+        {
+            visit(llround((poly->point_array[k].x - origin.x) / step));
+            visit(llround((poly->point_array[k].y - origin.y) / step));
+        }
+
+        offsets.count = 0;
+        if (poly->repetition.type != RepetitionType::None)
+            poly->repetition.get_offsets(offsets);
+        visit((int64_t)offsets.count);
+        for (uint64_t k = 0; k < offsets.count; k++)
+        {
+            visit(llround(offsets[k].x / step));
+            visit(llround(offsets[k].y / step));
+        }
+    }
+}
+
+void cell_aliases::build(const Array<Cell *> &cells, double step)
+{
+    clear();
+    cells_group.assign(cells.count, NO_GROUP);
+    origins.assign(cells.count, Vec2{0, 0});
+
+    Array<Polygon *> polygons = {};
+    Array<Polygon *> owned = {};
+
+    // (hash, cell) of the cells with shapes, the ones with the same hash are compared
+    std::vector<std::pair<uint64_t, uint64_t>> hashes;
+    for (uint64_t i = 0; i < cells.count; i++)
+    {
+        cellPolygons(cells[i], polygons, owned);
+        if (polygonsOrigin(polygons, origins[i]))
+        {
+            uint64_t hash = 0xcbf29ce484222325ull;
+            visitPolygons(polygons, origins[i], step, [&hash](int64_t value)
+                          { hash = (hash ^ (uint64_t)value) * 0x100000001b3ull; hash ^= hash >> 29; });
+            hashes.push_back({hash, i});
+        }
+        freeOwned(owned);
+    }
+    std::sort(hashes.begin(), hashes.end());
+
+    // Values of the first cell of each group found in a run of equal hashes
+    struct candidate
+    {
+        std::vector<int64_t> values;
+        uint64_t cell_idx;
+        uint32_t group;
+    };
+    std::vector<candidate> candidates;
+    std::vector<int64_t> values;
+
+    for (uint64_t begin = 0; begin < hashes.size();)
+    {
+        uint64_t end = begin + 1;
+        while (end < hashes.size() && hashes[end].first == hashes[begin].first)
+            end++;
+
+        candidates.clear();
+        for (uint64_t h = begin; h < end && end - begin > 1; h++)
+        {
+            const uint64_t cell_idx = hashes[h].second;
+            values.clear();
+            cellPolygons(cells[cell_idx], polygons, owned);
+            visitPolygons(polygons, origins[cell_idx], step, [&values](int64_t value)
+                          { values.push_back(value); });
+            freeOwned(owned);
+
+            bool matched = false;
+            for (candidate &other : candidates)
+            {
+                if (other.values != values)
+                    continue;
+                if (other.group == NO_GROUP)
+                {
+                    other.group = (uint32_t)groups_source.size();
+                    groups_source.push_back(NO_CELL);
+                    cells_group[other.cell_idx] = other.group;
+                }
+                cells_group[cell_idx] = other.group;
+                matched = true;
+                break;
+            }
+            if (!matched)
+                candidates.push_back({values, cell_idx, NO_GROUP});
+        }
+        begin = end;
+    }
+
+    polygons.clear();
+    owned.clear();
+}
+
+uint64_t cell_aliases::aliasesCount() const
+{
+    uint64_t grouped = 0;
+    for (uint32_t group : cells_group)
+        if (group != NO_GROUP)
+            grouped++;
+    return grouped - groups_source.size();
+}
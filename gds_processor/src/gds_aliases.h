@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <gdstk/gdstk.hpp>
+
+// Cells whose shapes are the same up to a translation (alias_identical_cells process option), e.g. the copies of a standard
+// cell or macro renamed for each project. Only one cell of each group is built, the others are emitted as aliases of it.
+// Shapes are compared in order, as integer steps of the database precision relative to the min of the cell own shapes
+struct cell_aliases
+{
+    static constexpr uint32_t NO_GROUP = UINT32_MAX;
+    static constexpr uint64_t NO_CELL = UINT64_MAX;
+
+    // Group of each cell (same order as the library cells), NO_GROUP for the cells without copies or without shapes
+    std::vector<uint32_t> cells_group;
+    // Min of the own shapes of each cell: a cell of a group is any other one moved by the difference of their origins
+    std::vector<gdstk::Vec2> origins;
+    // Cell whose meshes were emitted for each group, NO_CELL until one is built
+    std::vector<uint64_t> groups_source;
+
+    void clear()
+    {
+        cells_group.clear();
+        origins.clear();
+        groups_source.clear();
+    }
+    // step: database precision in user units
+    void build(const gdstk::Array<gdstk::Cell *> &cells, double step);
+    // Cells of the groups that can be emitted as aliases (all but one per group)
+    uint64_t aliasesCount() const;
+};
@@ -0,0 +1,50 @@
+#include <string.h>
+#include "gds_culling.h"
+
+using namespace gdstk;
+
+size_t hidden_faces::edge_key_hash::operator()(const edge_key &key) const
+{
+    uint64_t bits[4];
+    memcpy(bits, &key, sizeof(bits));
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (int i = 0; i < 4; i++)
+        hash = (hash ^ bits[i]) * 0x100000001b3ull;
+    return (size_t)(hash ^ (hash >> 32));
+}
+
+static inline bool pointLess(const Vec2 &a, const Vec2 &b)
+{
+    return a.x < b.x || (a.x == b.x && a.y < b.y);
+}
+
+void hidden_faces::find(const Array<Polygon *> &polygons)
+{
+    edges.clear();
+
+    for (uint64_t j = 0; j < polygons.count; j++)
+    {
+        const Polygon *poly = polygons[j];
+        const double area = poly->signed_area();
+        if (area == 0)
+            continue;
+
+        // The polygon lies on the left of its edges when counterclockwise
+        const uint64_t points_count = poly->point_array.count;
+        for (uint64_t k = 0; k < points_count; k++)
+        {
+            const Vec2 &a = poly->point_array[k];
+            const Vec2 &b = poly->point_array[(k + 1) % points_count];
+            const bool forward = pointLess(a, b);
+            const edge_key key = forward ? edge_key{a.x, a.y, b.x, b.y} : edge_key{b.x, b.y, a.x, a.y};
+            edges[key] |= (forward == (area > 0)) ? 1 : 2;
+        }
+    }
+}
+
+bool hidden_faces::sideHidden(const Vec2 &a, const Vec2 &b) const
+{
+    const edge_key key = pointLess(a, b) ? edge_key{a.x, a.y, b.x, b.y} : edge_key{b.x, b.y, a.x, a.y};
+    auto it = edges.find(key);
+    return it != edges.end() && it->second == 3;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <unordered_map>
+#include <gdstk/gdstk.hpp>
+
+// Side walls of the extruded polygons of one layer that can never be seen: the ones on an edge shared by polygons that lie on
+// both sides of it (abutting shapes, and the cut lines of polygons with holes). Both polygons are in the same layer mesh, so the
+// wall stays inside the solid even when the viewer hides or separates layers. Faces against other layers are never culled
+// Only exact matches are found: walls on edges that partially overlap are kept
+struct hidden_faces
+{
+    void find(const gdstk::Array<gdstk::Polygon *> &polygons);
+    // Side wall of the polygon edge a -> b
+    bool sideHidden(const gdstk::Vec2 &a, const gdstk::Vec2 &b) const;
+
+private:
+    struct edge_key
+    {
+        double x0, y0, x1, y1;
+        bool operator==(const edge_key &other) const
+        {
+            return x0 == other.x0 && y0 == other.y0 && x1 == other.x1 && y1 == other.y1;
+        }
+    };
+    struct edge_key_hash
+    {
+        size_t operator()(const edge_key &key) const;
+    };
+
+    // Sides of each edge (from its lower to its higher end point) that have a polygon: 1 left, 2 right
+    std::unordered_map<edge_key, uint8_t, edge_key_hash> edges;
+};
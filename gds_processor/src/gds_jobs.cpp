@@ -0,0 +1,163 @@
+#include "gds_jobs.h"
+
+#ifdef GDS_PROCESSOR_THREADS
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct job_range
+{
+    std::mutex mutex;
+    uint64_t begin = 0;
+    uint64_t end = 0;
+};
+
+static bool popJob(job_range &range, uint64_t &job_idx)
+{
+    std::lock_guard<std::mutex> lock(range.mutex);
+    if (range.begin >= range.end)
+        return false;
+    job_idx = range.begin++;
+    return true;
+}
+
+// Takes the second half of the jobs left in some other worker's range
+// Only one range is locked at a time, so workers can't deadlock stealing from each other
+static bool stealJobs(std::vector<std::unique_ptr<job_range>> &ranges, uint32_t workers_count, uint32_t worker_idx)
+{
+    for (uint32_t i = 1; i < workers_count; i++)
+    {
+        job_range &victim = *ranges[(worker_idx + i) % workers_count];
+        uint64_t stolen_begin, stolen_end;
+        {
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.begin >= victim.end)
+                continue;
+            uint64_t remaining = victim.end - victim.begin;
+            stolen_end = victim.end;
+            stolen_begin = victim.end - (remaining + 1) / 2;
+            victim.end = stolen_begin;
+        }
+
+        std::lock_guard<std::mutex> lock(ranges[worker_idx]->mutex);
+        ranges[worker_idx]->begin = stolen_begin;
+        ranges[worker_idx]->end = stolen_end;
+        return true;
+    }
+    return false;
+}
+
+// Worker threads are started the first time a batch needs them and then wait for the next batch (generation changes)
+// The pool is never destroyed: the threads are blocked on batch_ready when the process exits
+struct job_pool
+{
+    std::mutex run_mutex; // one batch at a time
+    std::mutex mutex;
+    std::condition_variable batch_ready;
+    std::condition_variable batch_done;
+    std::vector<std::thread> threads; // threads[i] is worker i + 1
+    std::vector<std::unique_ptr<job_range>> ranges;
+
+    const std::function<void(uint32_t worker_idx, uint64_t job_idx)> *job = NULL;
+    uint32_t workers_count = 0;
+    uint64_t generation = 0;
+    uint32_t running = 0; // pool threads still working on the current batch
+
+    void work(uint32_t worker_idx)
+    {
+        uint64_t job_idx;
+        do
+        {
+            while (popJob(*ranges[worker_idx], job_idx))
+                (*job)(worker_idx, job_idx);
+        } while (stealJobs(ranges, workers_count, worker_idx));
+    }
+
+    void threadLoop(uint32_t worker_idx, uint64_t seen_generation)
+    {
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                batch_ready.wait(lock, [&]
+                                 { return generation != seen_generation; });
+                seen_generation = generation;
+                if (worker_idx >= workers_count)
+                    continue;
+            }
+
+            work(worker_idx);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--running == 0)
+                batch_done.notify_one();
+        }
+    }
+};
+
+static job_pool &g_job_pool = *new job_pool();
+
+void runJobs(uint64_t jobs_count, uint32_t threads_count, const std::function<void(uint32_t worker_idx, uint64_t job_idx)> &job)
+{
+    if (threads_count > jobs_count)
+        threads_count = jobs_count;
+
+    if (threads_count <= 1)
+    {
+        for (uint64_t i = 0; i < jobs_count; i++)
+            job(0, i);
+        return;
+    }
+
+    job_pool &pool = g_job_pool;
+    std::lock_guard<std::mutex> run_lock(pool.run_mutex);
+
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        while (pool.ranges.size() < threads_count)
+            pool.ranges.emplace_back(new job_range());
+        for (uint32_t i = 0; i < threads_count; i++)
+        {
+            pool.ranges[i]->begin = jobs_count * i / threads_count;
+            pool.ranges[i]->end = jobs_count * (i + 1) / threads_count;
+        }
+        while (pool.threads.size() + 1 < threads_count)
+            pool.threads.emplace_back(&job_pool::threadLoop, &pool, (uint32_t)pool.threads.size() + 1, pool.generation);
+
+        pool.job = &job;
+        pool.workers_count = threads_count;
+        pool.running = threads_count - 1;
+        pool.generation++;
+    }
+    pool.batch_ready.notify_all();
+
+    pool.work(0);
+
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    pool.batch_done.wait(lock, [&]
+                         { return pool.running == 0; });
+    pool.job = NULL;
+}
+
+uint32_t maxJobThreads()
+{
+    uint32_t count = std::thread::hardware_concurrency();
+    return count > 0 ? count : 1;
+}
+
+#else
+
+void runJobs(uint64_t jobs_count, uint32_t threads_count, const std::function<void(uint32_t worker_idx, uint64_t job_idx)> &job)
+{
+    for (uint64_t i = 0; i < jobs_count; i++)
+        job(0, i);
+}
+
+uint32_t maxJobThreads()
+{
+    return 1;
+}
+
+#endif
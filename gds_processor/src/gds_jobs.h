@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+
+// Runs job(worker_idx, job_idx) for every job_idx in [0, jobs_count), using up to threads_count workers (the calling thread is worker 0).
+// Each worker starts with a contiguous range of jobs and, when it runs out, steals half of what is left in another worker's range.
+// Jobs must be independent from each other. Returns when all of them are done.
+// The worker threads are kept between calls, waiting for the next batch of jobs.
+// Without GDS_PROCESSOR_THREADS everything runs on the calling thread.
+void runJobs(uint64_t jobs_count, uint32_t threads_count, const std::function<void(uint32_t worker_idx, uint64_t job_idx)> &job);
+
+// Max number of workers runJobs can use in this build
+uint32_t maxJobThreads();
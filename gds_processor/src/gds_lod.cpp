@@ -0,0 +1,110 @@
+#include <algorithm>
+#include "gds_lod.h"
+
+using namespace gdstk;
+
+// Triangles of an extruded box (RECTANGLE_INDICES / 3)
+static constexpr uint64_t BOX_TRIANGLES = 12;
+
+// Greedy merge of the covered grid cells in boxes: each box grows along its row first, then down the next rows
+static void coverageBoxes(const double coverage[LOD_GRID_SIDE][LOD_GRID_SIDE], const Vec2 &min, const Vec2 &cell_size, std::vector<lod_box> &result)
+{
+    bool covered[LOD_GRID_SIDE][LOD_GRID_SIDE];
+    for (uint32_t row = 0; row < LOD_GRID_SIDE; row++)
+        for (uint32_t column = 0; column < LOD_GRID_SIDE; column++)
+            covered[row][column] = coverage[row][column] >= LOD_GRID_COVERAGE * cell_size.x * cell_size.y;
+
+    for (uint32_t row = 0; row < LOD_GRID_SIDE; row++)
+    {
+        for (uint32_t column = 0; column < LOD_GRID_SIDE; column++)
+        {
+            if (!covered[row][column])
+                continue;
+
+            uint32_t column_end = column + 1;
+            while (column_end < LOD_GRID_SIDE && covered[row][column_end])
+                column_end++;
+
+            uint32_t row_end = row + 1;
+            while (row_end < LOD_GRID_SIDE && std::all_of(covered[row_end] + column, covered[row_end] + column_end, [](bool c)
+                                                           { return c; }))
+                row_end++;
+
+            for (uint32_t r = row; r < row_end; r++)
+                std::fill(covered[r] + column, covered[r] + column_end, false);
+
+            const Vec2 box_min = {min.x + column * cell_size.x, min.y + row * cell_size.y};
+            const Vec2 box_max = {min.x + column_end * cell_size.x, min.y + row_end * cell_size.y};
+            result.push_back({box_min, box_max});
+        }
+    }
+}
+
+void layer_lods::build(const Array<Polygon *> &polygons, uint32_t levels_count, uint64_t full_triangles)
+{
+    clear();
+    if (polygons.count == 0 || levels_count == 0)
+        return;
+
+    Vec2 min, max;
+    polygons[0]->bounding_box(min, max);
+    for (uint64_t i = 1; i < polygons.count; i++)
+    {
+        Vec2 poly_min, poly_max;
+        polygons[i]->bounding_box(poly_min, poly_max);
+        min.x = std::min(min.x, poly_min.x);
+        min.y = std::min(min.y, poly_min.y);
+        max.x = std::max(max.x, poly_max.x);
+        max.y = std::max(max.y, poly_max.y);
+    }
+    if (max.x <= min.x || max.y <= min.y)
+        return;
+
+    // A level is kept when it takes less than half the triangles of the previous one
+    uint64_t previous_triangles = full_triangles;
+
+    {
+        const Vec2 cell_size = {(max.x - min.x) / LOD_GRID_SIDE, (max.y - min.y) / LOD_GRID_SIDE};
+        double coverage[LOD_GRID_SIDE][LOD_GRID_SIDE] = {};
+        for (uint64_t i = 0; i < polygons.count; i++)
+        {
+            Vec2 poly_min, poly_max;
+            polygons[i]->bounding_box(poly_min, poly_max);
+
+            const uint32_t column_begin = std::min((uint32_t)((poly_min.x - min.x) / cell_size.x), LOD_GRID_SIDE - 1);
+            const uint32_t column_end = std::min((uint32_t)((poly_max.x - min.x) / cell_size.x), LOD_GRID_SIDE - 1);
+            const uint32_t row_begin = std::min((uint32_t)((poly_min.y - min.y) / cell_size.y), LOD_GRID_SIDE - 1);
+            const uint32_t row_end = std::min((uint32_t)((poly_max.y - min.y) / cell_size.y), LOD_GRID_SIDE - 1);
+            for (uint32_t row = row_begin; row <= row_end; row++)
+            {
+                const double y0 = std::max(poly_min.y, min.y + row * cell_size.y);
+                const double y1 = std::min(poly_max.y, min.y + (row + 1) * cell_size.y);
+                for (uint32_t column = column_begin; column <= column_end; column++)
+                {
+                    const double x0 = std::max(poly_min.x, min.x + column * cell_size.x);
+                    const double x1 = std::min(poly_max.x, min.x + (column + 1) * cell_size.x);
+                    if (x1 > x0 && y1 > y0)
+                        coverage[row][column] += (x1 - x0) * (y1 - y0);
+                }
+            }
+        }
+
+        std::vector<lod_box> &level_boxes = boxes[count];
+        coverageBoxes(coverage, min, cell_size, level_boxes);
+        if (!level_boxes.empty() && level_boxes.size() * BOX_TRIANGLES * 2 <= previous_triangles)
+        {
+            previous_triangles = level_boxes.size() * BOX_TRIANGLES;
+            levels[count++] = 1;
+        }
+        else
+        {
+            level_boxes.clear();
+        }
+    }
+
+    if (levels_count >= 2 && BOX_TRIANGLES * 2 <= previous_triangles)
+    {
+        boxes[count].push_back({min, max});
+        levels[count++] = 2;
+    }
+}
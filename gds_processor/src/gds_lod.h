@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <gdstk/gdstk.hpp>
+
+// Coarse levels of detail per (cell, layer), drawn instead of the full meshes when the cell is small on screen:
+//   level 1: the layer coverage on a LOD_GRID_SIDE x LOD_GRID_SIDE grid over the layer bounding box, as merged boxes
+//   level 2: the layer bounding box
+constexpr uint32_t MAX_LOD_LEVELS = 2;
+constexpr uint32_t LOD_GRID_SIDE = 16;
+// Fraction of a grid cell the polygons (their bounding boxes) have to cover to be part of level 1
+constexpr double LOD_GRID_COVERAGE = 0.25;
+
+// Size in pixels of the larger side of the cell on screen below which each level is used
+constexpr float LOD_MAX_SCREEN_SIZE[MAX_LOD_LEVELS] = {4.0f * LOD_GRID_SIDE, 8.0f};
+
+struct lod_box
+{
+    gdstk::Vec2 min;
+    gdstk::Vec2 max;
+};
+
+struct layer_lods
+{
+    // Levels kept (a level is left out when it doesn't save enough triangles), boxes[i] is level levels[i]
+    uint32_t count = 0;
+    uint32_t levels[MAX_LOD_LEVELS] = {};
+    std::vector<lod_box> boxes[MAX_LOD_LEVELS];
+
+    void clear()
+    {
+        count = 0;
+        for (auto &level_boxes : boxes)
+            level_boxes.clear();
+    }
+
+    // Builds the first levels_count levels of the polygons, full_triangles is the triangles count of the full detail mesh
+    void build(const gdstk::Array<gdstk::Polygon *> &polygons, uint32_t levels_count, uint64_t full_triangles);
+};
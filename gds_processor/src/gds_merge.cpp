@@ -0,0 +1,166 @@
+#include <math.h>
+#include <algorithm>
+#include "gds_merge.h"
+#include "gds_trace.h"
+
+using namespace gdstk;
+
+static void freePolygons(Array<Polygon *> &polygons)
+{
+    for (uint64_t i = 0; i < polygons.count; i++)
+    {
+        polygons[i]->clear();
+        free_allocation(polygons[i]);
+    }
+    polygons.count = 0;
+}
+
+layer_merge::~layer_merge()
+{
+    for (auto &inputs : tile_inputs)
+        inputs.clear();
+    for (auto &results : tile_results)
+    {
+        freePolygons(results);
+        results.clear();
+    }
+}
+
+void layer_merge::prepare(const Array<Polygon *> &polygons, double scaling)
+{
+    trace_scope scope(TRACE_MERGE);
+    this->scaling = scaling;
+    columns = 0;
+    rows = 0;
+    if (polygons.count == 0)
+        return;
+
+    Vec2 max;
+    polygons[0]->bounding_box(min, max);
+    for (uint64_t i = 1; i < polygons.count; i++)
+    {
+        Vec2 poly_min, poly_max;
+        polygons[i]->bounding_box(poly_min, poly_max);
+        min.x = std::min(min.x, poly_min.x);
+        min.y = std::min(min.y, poly_min.y);
+        max.x = std::max(max.x, poly_max.x);
+        max.y = std::max(max.y, poly_max.y);
+    }
+
+    // Square-ish grid with about TILE_POLYGONS polygons per tile
+    const uint32_t side = (uint32_t)ceil(sqrt((double)polygons.count / TILE_POLYGONS));
+    columns = std::max(side, 1u);
+    rows = std::max(side, 1u);
+    tile_size.x = (max.x - min.x) / columns;
+    tile_size.y = (max.y - min.y) / rows;
+    if (tile_size.x <= 0 || tile_size.y <= 0)
+        columns = rows = 1;
+
+    if (tile_inputs.size() < tilesCount())
+    {
+        tile_inputs.resize(tilesCount(), Array<Polygon *>{});
+        tile_results.resize(tilesCount(), Array<Polygon *>{});
+    }
+    for (uint32_t t = 0; t < tilesCount(); t++)
+        tile_inputs[t].count = 0;
+
+    if (tilesCount() == 1)
+    {
+        tile_inputs[0].extend(polygons);
+        return;
+    }
+
+    // A polygon goes to every tile its bounding box overlaps
+    for (uint64_t i = 0; i < polygons.count; i++)
+    {
+        Vec2 poly_min, poly_max;
+        polygons[i]->bounding_box(poly_min, poly_max);
+
+        const uint32_t column_begin = std::min((uint32_t)((poly_min.x - min.x) / tile_size.x), columns - 1);
+        const uint32_t column_end = std::min((uint32_t)((poly_max.x - min.x) / tile_size.x), columns - 1);
+        const uint32_t row_begin = std::min((uint32_t)((poly_min.y - min.y) / tile_size.y), rows - 1);
+        const uint32_t row_end = std::min((uint32_t)((poly_max.y - min.y) / tile_size.y), rows - 1);
+
+        for (uint32_t row = row_begin; row <= row_end; row++)
+            for (uint32_t column = column_begin; column <= column_end; column++)
+                tile_inputs[row * columns + column].append(polygons[i]);
+    }
+}
+
+void layer_merge::mergeTile(uint32_t tile_idx)
+{
+    trace_scope scope(TRACE_MERGE);
+    Array<Polygon *> &inputs = tile_inputs[tile_idx];
+    Array<Polygon *> &results = tile_results[tile_idx];
+    freePolygons(results);
+
+    if (inputs.count == 0)
+        return;
+
+    if (tilesCount() == 1)
+    {
+        const Array<Polygon *> none = {};
+        boolean(inputs, none, Operation::Or, scaling, results);
+        return;
+    }
+
+    // Both operands are filled non-zero, so AND with the tile is the union of the inputs clipped to the tile
+    const uint32_t column = tile_idx % columns;
+    const uint32_t row = tile_idx / columns;
+    const Vec2 tile_min = {min.x + column * tile_size.x, min.y + row * tile_size.y};
+    const Vec2 tile_max = {tile_min.x + tile_size.x, tile_min.y + tile_size.y};
+
+    Polygon tile_rectangle = rectangle(tile_min, tile_max, 0);
+    Polygon *clip_items[] = {&tile_rectangle};
+    const Array<Polygon *> clip = {1, 1, clip_items};
+    boolean(inputs, clip, Operation::And, scaling, results);
+    tile_rectangle.clear();
+}
+
+void layer_merge::finish(Array<Polygon *> &result)
+{
+    trace_scope scope(TRACE_MERGE);
+    const uint32_t tiles_count = tilesCount();
+    if (tiles_count == 1)
+    {
+        result.extend(tile_results[0]);
+        tile_results[0].count = 0;
+        return;
+    }
+
+    // Pieces touching an inner tile border (up to the boolean grid resolution) are stitched with their neighbors
+    const double tolerance = 1 / scaling;
+    Array<Polygon *> stitch = {};
+    for (uint32_t t = 0; t < tiles_count; t++)
+    {
+        const uint32_t column = t % columns;
+        const uint32_t row = t / columns;
+        const double tile_x0 = min.x + column * tile_size.x;
+        const double tile_y0 = min.y + row * tile_size.y;
+
+        Array<Polygon *> &results = tile_results[t];
+        for (uint64_t i = 0; i < results.count; i++)
+        {
+            Vec2 poly_min, poly_max;
+            results[i]->bounding_box(poly_min, poly_max);
+
+            const bool touches_border = (column > 0 && poly_min.x <= tile_x0 + tolerance) ||
+                                        (column + 1 < columns && poly_max.x >= tile_x0 + tile_size.x - tolerance) ||
+                                        (row > 0 && poly_min.y <= tile_y0 + tolerance) ||
+                                        (row + 1 < rows && poly_max.y >= tile_y0 + tile_size.y - tolerance);
+            if (touches_border)
+                stitch.append(results[i]);
+            else
+                result.append(results[i]);
+        }
+        results.count = 0;
+    }
+
+    if (stitch.count > 0)
+    {
+        const Array<Polygon *> none = {};
+        boolean(stitch, none, Operation::Or, scaling, result);
+        freePolygons(stitch);
+    }
+    stitch.clear();
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <gdstk/gdstk.hpp>
+
+// Union (boolean OR) of the polygons of one layer, split in tiles so the tiles can run in parallel.
+// Each tile ORs the polygons that overlap it, clipped to the tile rectangle. The pieces that touch an inner tile border
+// are then ORed together to stitch the tiles, the other pieces can't touch anything outside their tile.
+// Usage: prepare, mergeTile for every tile (any order, any thread), finish
+struct layer_merge
+{
+    // Polygons per tile the layer is split for
+    static constexpr uint64_t TILE_POLYGONS = 2048;
+
+    double scaling = 1000;
+    gdstk::Vec2 min = {};
+    gdstk::Vec2 tile_size = {};
+    uint32_t columns = 0;
+    uint32_t rows = 0;
+    // Inputs are the layer polygons (not owned), results are allocated by gdstk::boolean
+    std::vector<gdstk::Array<gdstk::Polygon *>> tile_inputs;
+    std::vector<gdstk::Array<gdstk::Polygon *>> tile_results;
+
+    ~layer_merge();
+
+    // scaling: boolean() integer coordinates scale (1 / database precision in user units)
+    void prepare(const gdstk::Array<gdstk::Polygon *> &polygons, double scaling);
+    uint32_t tilesCount() const
+    {
+        return columns * rows;
+    }
+    void mergeTile(uint32_t tile_idx);
+    // Appends the merged polygons to result. The caller owns them
+    void finish(gdstk::Array<gdstk::Polygon *> &result);
+};
@@ -0,0 +1,232 @@
+#include <chrono>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "gds_processor.h"
+#include "gds_output_native.h"
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+using namespace gdstk;
+
+native_output_stats g_native_output_stats;
+
+static FILE *g_obj_file = NULL;
+static uint64_t g_obj_vertex_base = 0;
+static bool g_verbose = false;
+
+bool nativeOutputOpen(const char *obj_filepath)
+{
+    nativeOutputClose();
+    g_obj_file = fopen(obj_filepath, "w");
+    g_obj_vertex_base = 0;
+    return g_obj_file != NULL;
+}
+
+void nativeOutputClose()
+{
+    if (g_obj_file != NULL)
+        fclose(g_obj_file);
+    g_obj_file = NULL;
+}
+
+void nativeOutputSetVerbose(bool verbose)
+{
+    g_verbose = verbose;
+}
+
+template <typename T>
+static void writeObjVertices(const T *positions, uint64_t positions_count, const cell_meshes_header &header, const cell_mesh_entry &entry)
+{
+    const bool quantized = header.flags & CELL_MESHES_FLAG_QUANTIZED;
+    for (uint64_t i = 0; i + 2 < positions_count; i += 3)
+    {
+        if (quantized)
+            fprintf(g_obj_file, "v %.9g %.9g %g\n", header.origin_x + positions[i] * header.step, header.origin_y + positions[i + 1] * header.step, entry.z_levels[(int)positions[i + 2]]);
+        else
+            fprintf(g_obj_file, "v %g %g %g\n", (double)positions[i], (double)positions[i + 1], (double)positions[i + 2]);
+    }
+}
+
+template <typename T>
+static void writeObjTriangles(const T *indices, uint64_t indices_count)
+{
+    // OBJ indices are 1-based and global to the file
+    for (uint64_t i = 0; i + 2 < indices_count; i += 3)
+        fprintf(g_obj_file, "f %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", (uint64_t)indices[i] + g_obj_vertex_base + 1, (uint64_t)indices[i + 1] + g_obj_vertex_base + 1, (uint64_t)indices[i + 2] + g_obj_vertex_base + 1);
+}
+
+template <typename T>
+static void writeObjLines(const T *indices, uint64_t indices_count)
+{
+    // Line strips are separated by the primitive restart index
+    bool line_open = false;
+    for (uint64_t i = 0; i < indices_count; i++)
+    {
+        if (indices[i] == (T)RESTART_INDEX_VALUE)
+        {
+            if (line_open)
+                fprintf(g_obj_file, "\n");
+            line_open = false;
+            continue;
+        }
+        if (!line_open)
+            fprintf(g_obj_file, "l");
+        fprintf(g_obj_file, " %" PRIu64, (uint64_t)indices[i] + g_obj_vertex_base + 1);
+        line_open = true;
+    }
+    if (line_open)
+        fprintf(g_obj_file, "\n");
+}
+
+void JS_gds_info_log(const char *format, ...)
+{
+    if (!g_verbose)
+        return;
+
+    va_list args;
+    va_start(args, format);
+
+    time_t now = clock();
+    double elapsed_time = ((double)(now - g_start_time)) / CLOCKS_PER_SEC;
+
+    fprintf(stderr, "[%8.3f] ", elapsed_time);
+    vfprintf(stderr, format, args);
+
+    va_end(args);
+}
+
+memory_stats getMemoryStats()
+{
+    memory_stats memory = {};
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    memory.used = mallinfo2().uordblks;
+#endif
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    // ru_maxrss is in kilobytes on Linux
+    memory.peak = (uint64_t)usage.ru_maxrss * 1024;
+
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL)
+    {
+        uint64_t size_pages = 0, resident_pages = 0;
+        if (fscanf(statm, "%" SCNu64 " %" SCNu64, &size_pages, &resident_pages) == 2)
+            memory.reserved = resident_pages * (uint64_t)sysconf(_SC_PAGESIZE);
+        fclose(statm);
+    }
+    return memory;
+}
+
+void JS_gds_stats(const char *design_name, LibraryInfo &info, const memory_stats &memory)
+{
+    printf("design: %s\n", design_name);
+    printf("\tcells: %" PRIu64 "\n", info.cell_names.count);
+    printf("\tshape_tags: %" PRIu64 "\n", info.shape_tags.count);
+    printf("\tlabel_tags: %" PRIu64 "\n", info.label_tags.count);
+    printf("\tpolygons: %" PRIu64 "\n", info.num_polygons);
+    printf("\tpaths: %" PRIu64 "\n", info.num_paths);
+    printf("\treferences: %" PRIu64 "\n", info.num_references);
+    printf("\tlabels: %" PRIu64 "\n", info.num_labels);
+    printf("\tmemory used: %.1f MB, peak: %.1f MB, resident: %.1f MB\n", memory.used / (1024.0 * 1024.0), memory.peak / (1024.0 * 1024.0), memory.reserved / (1024.0 * 1024.0));
+}
+
+void JS_gds_add_cell(const char *cell_name, Vec2 &min, Vec2 &max, bool is_top_cell)
+{
+    g_native_output_stats.cells++;
+}
+
+void JS_gds_add_cell_meshes(const char *cell_name, GrowBuffer<unsigned char> &cell_meshes)
+{
+    const cell_meshes_header *header = (const cell_meshes_header *)cell_meshes.data;
+    const cell_mesh_entry *entries = (const cell_mesh_entry *)(cell_meshes.data + sizeof(cell_meshes_header));
+    const bool lines = header->flags & CELL_MESHES_FLAG_LINES;
+
+    // Placeholders are replaced by the real meshes of the cell, only those are counted and written
+    if (header->flags & CELL_MESHES_FLAG_PLACEHOLDER)
+        return;
+
+    if (lines)
+        g_native_output_stats.lines += header->meshes_count;
+    else
+        g_native_output_stats.meshes += header->meshes_count;
+    g_native_output_stats.bytes_emitted += cell_meshes.size();
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < header->meshes_count; i++)
+    {
+        const cell_mesh_entry &entry = entries[i];
+        g_native_output_stats.positions_count += entry.positions_count;
+        g_native_output_stats.indices_count += entry.indices_count;
+
+        if (g_obj_file == NULL)
+            continue;
+
+        const unsigned char *positions = cell_meshes.data + entry.positions_offset;
+        const unsigned char *indices = cell_meshes.data + entry.indices_offset;
+
+        if (entry.lod_level > 0)
+            fprintf(g_obj_file, "o %s_%s_lod%u\n", cell_name, g_layer_stack[entry.layer_idx].name, entry.lod_level);
+        else
+            fprintf(g_obj_file, "o %s_%s\n", cell_name, g_layer_stack[entry.layer_idx].name);
+        if (entry.positions_format == CELL_MESH_POSITIONS_INT16)
+            writeObjVertices((const int16_t *)positions, entry.positions_count, *header, entry);
+        else if (entry.positions_format == CELL_MESH_POSITIONS_INT32)
+            writeObjVertices((const int32_t *)positions, entry.positions_count, *header, entry);
+        else
+            writeObjVertices((const POSITIONS_TYPE *)positions, entry.positions_count, *header, entry);
+        if (entry.index_size == sizeof(uint16_t))
+        {
+            if (lines)
+                writeObjLines((const uint16_t *)indices, entry.indices_count);
+            else
+                writeObjTriangles((const uint16_t *)indices, entry.indices_count);
+        }
+        else
+        {
+            if (lines)
+                writeObjLines((const INDICES_TYPE *)indices, entry.indices_count);
+            else
+                writeObjTriangles((const INDICES_TYPE *)indices, entry.indices_count);
+        }
+        g_obj_vertex_base += entry.positions_count / 3;
+    }
+
+    g_native_output_stats.output_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void JS_gds_add_cell_alias(const char *cell_name, const char *source_cell_name, double offset_x, double offset_y)
+{
+    g_native_output_stats.aliases++;
+    // OBJ has no instances, the alias is only noted
+    if (g_obj_file != NULL)
+        fprintf(g_obj_file, "# %s: meshes of %s moved by (%g, %g)\n", cell_name, source_cell_name, offset_x, offset_y);
+}
+
+void JS_gds_add_cell_labels(const char *cell_name, GrowBuffer<unsigned char> &cell_labels)
+{
+    g_native_output_stats.labels += ((const cell_labels_header *)cell_labels.data)->labels_count;
+}
+
+void JS_gds_add_references(GrowBuffer<unsigned char> &references)
+{
+    const references_header *header = (const references_header *)references.data;
+    const reference_entry *entries = (const reference_entry *)(references.data + header->entries_offset);
+
+    // Counted per instance, arrays included
+    for (uint32_t i = 0; i < header->references_count; i++)
+        g_native_output_stats.references += (uint64_t)entries[i].columns * entries[i].rows;
+}
+
+void JS_gds_finished_references()
+{
+}
+
+void JS_gds_finished_placeholders()
+{
+}
+
+void JS_gds_process_progress(float progress)
+{
+}
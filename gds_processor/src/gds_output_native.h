@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+// Native output sink configuration, used by gds_processor_cli
+
+struct native_output_stats
+{
+    uint64_t cells = 0;
+    uint64_t meshes = 0;
+    uint64_t lines = 0;
+    // Cells emitted with the meshes of an identical one (alias_identical_cells)
+    uint64_t aliases = 0;
+    uint64_t labels = 0;
+    uint64_t references = 0;
+    // Counts in items (floats / indices), as in cell_mesh_entry
+    uint64_t positions_count = 0;
+    uint64_t indices_count = 0;
+    uint64_t bytes_emitted = 0;
+    // Time spent writing the output file
+    double output_seconds = 0;
+};
+
+extern native_output_stats g_native_output_stats;
+
+// Meshes and lines are written as a Wavefront OBJ file. With no file open the sink only counts
+bool nativeOutputOpen(const char *obj_filepath);
+void nativeOutputClose();
+void nativeOutputSetVerbose(bool verbose);
@@ -0,0 +1,110 @@
+#include <malloc.h>
+#include <unistd.h>
+#include <emscripten/heap.h>
+#include "gds_processor.h"
+
+using namespace gdstk;
+
+static char g_log_msg_buffer[1024] = {};
+
+void JS_gds_info_log(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+
+    time_t now = clock();
+    double elapsed_time = ((double)(now - g_start_time)) / CLOCKS_PER_SEC;
+
+    vsnprintf(g_log_msg_buffer, sizeof(g_log_msg_buffer), format, args);
+    EM_ASM({ self.gds_info_log(UTF8ToString($0), $1); }, g_log_msg_buffer, elapsed_time);
+
+    va_end(args);
+}
+
+memory_stats getMemoryStats()
+{
+    memory_stats memory = {};
+    memory.used = mallinfo().uordblks;
+    // The heap only grows (sbrk), its top is the high-water mark
+    memory.peak = (uint64_t)(uintptr_t)sbrk(0);
+    memory.reserved = emscripten_get_heap_size();
+    return memory;
+}
+
+void JS_gds_stats(const char *design_name, LibraryInfo &info, const memory_stats &memory)
+{
+    EM_ASM(
+        { (
+              var design_name = UTF8ToString($0);
+              var stats = {
+                  designs : $1,
+                  shape_tags : $2,
+                  label_tags : $3,
+                  num_polygons : $4,
+                  num_paths : $5,
+                  num_references : $6,
+                  num_labels : $7,
+                  unit : $8,
+                  precision : $9,
+                  heap_used : $10,
+                  heap_peak : $11,
+                  heap_size : $12
+              };
+
+              gds_stats(design_name, stats);) },
+        design_name,
+        info.cell_names.count,
+        info.shape_tags.count,
+        info.label_tags.count,
+        info.num_polygons,
+        info.num_paths,
+        info.num_references,
+        info.num_labels,
+        info.unit,
+        info.precision,
+        (double)memory.used,
+        (double)memory.peak,
+        (double)memory.reserved);
+}
+
+void JS_gds_add_cell(const char *cell_name, Vec2 &min, Vec2 &max, bool is_top_cell)
+{
+    EM_ASM({ (
+                 let bounds = {min_x : $1, min_y : $2, max_x : $3, max_y : $4};
+                 gds_add_cell(UTF8ToString($0), bounds, $5);) }, cell_name, min.x, min.y, max.x, max.y, is_top_cell);
+}
+
+void JS_gds_add_cell_meshes(const char *cell_name, GrowBuffer<unsigned char> &cell_meshes)
+{
+    EM_ASM({ gds_add_cell_meshes(UTF8ToString($0), $1, $2); }, cell_name, cell_meshes.data, (uint32_t)cell_meshes.size());
+}
+
+void JS_gds_add_cell_alias(const char *cell_name, const char *source_cell_name, double offset_x, double offset_y)
+{
+    EM_ASM({ gds_add_cell_alias(UTF8ToString($0), UTF8ToString($1), $2, $3); }, cell_name, source_cell_name, offset_x, offset_y);
+}
+
+void JS_gds_add_cell_labels(const char *cell_name, GrowBuffer<unsigned char> &cell_labels)
+{
+    EM_ASM({ gds_add_cell_labels(UTF8ToString($0), $1, $2); }, cell_name, cell_labels.data, (uint32_t)cell_labels.size());
+}
+
+void JS_gds_add_references(GrowBuffer<unsigned char> &references)
+{
+    EM_ASM({ gds_add_references($0, $1); }, references.data, (uint32_t)references.size());
+}
+
+void JS_gds_finished_references()
+{
+    EM_ASM({ gds_finished_references(); });
+}
+
+void JS_gds_finished_placeholders()
+{
+    EM_ASM({ gds_finished_placeholders(); });
+}
+
+void JS_gds_process_progress(float progress)
+{
+    EM_ASM({gds_process_progress($0)}, progress);
+}
@@ -1,106 +1,138 @@
-#include <emscripten.h>
-#include <stdio.h>
-#include <stdarg.h>
-#include <time.h>
 #include <libqhull_r/qhull_ra.h>
-#include <gdstk/gdstk.hpp>
-#include <CDT.h>
-
-// #define TEST_MERGE_SAME_LAYER_POLYS
-
-#define ARRAY_LENGTH(some_array) (sizeof(some_array) / sizeof(some_array[0]))
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <memory>
+#include "gds_processor.h"
+#include "gds_jobs.h"
+#include "gds_rectangles.h"
+#include "gds_merge.h"
+#include "gds_culling.h"
+#include "gds_lod.h"
+#include "gds_region.h"
+#include "gds_triangulation.h"
+#include "gds_aliases.h"
+#include "gds_trace.h"
 
 using namespace gdstk;
 
-#define INDICES_TYPE uint32_t
-#define RESTART_INDEX_VALUE 0xffffffff
-#define POSITIONS_TYPE float
-
-struct layer_stack_data;
 Array<layer_stack_data> g_layer_stack = {};
 
-static char g_log_msg_buffer[1024] = {};
 static gdstk::Library g_lib;
 clock_t g_start_time;
 
-template <typename T>
-struct GrowBuffer;
-void triangulate(Array<Polygon *> &polygons, GrowBuffer<POSITIONS_TYPE> &positions_buffer, GrowBuffer<INDICES_TYPE> &indices_buffer, float zmin, float zmax);
-void createLineBuffers(Array<Polygon *> &polygons, GrowBuffer<POSITIONS_TYPE> &positions_buffer, GrowBuffer<INDICES_TYPE> &indices_buffer, float zmin, float zmax);
-void processReferencesHierarchy(Library &lib);
+struct process_options
+{
+    // Workers used by processCells (needs a build with GDS_PROCESSOR_THREADS)
+    uint32_t threads = 1;
+    // Merge the vertices with the same position inside each mesh
+    bool shared_vertices = false;
+    // Emit integer positions relative to the cell bounding box (see cell_meshes_header)
+    bool quantized_positions = false;
+    // Union the polygons of each layer before building the meshes, so overlapping shapes become one solid
+    bool merge_layers = false;
+    // Leave out the side walls between abutting polygons of a layer, which can't be seen (see hidden_faces)
+    bool cull_hidden_faces = false;
+    // Coarse levels of detail emitted for each (cell, layer), up to MAX_LOD_LEVELS (triangles only)
+    uint32_t lod_levels = 0;
+    // Keep the 2D triangulation of each (cell, tag) for the next processCells runs
+    bool triangulation_cache = false;
+    // processCells emits the cells by visual importance, after a bounding box placeholder of each one (triangles only)
+    bool progressive_emission = false;
+    // Log every cell and layer built. It's one log call per line, use the trace option to see where the time goes
+    bool log_cells = false;
+    // Free the shapes and labels of each cell once they are emitted, only the references are kept. Released cells can't be
+    // emitted again (resetProcessedCells), so nothing is kept for that either (triangulation_cache)
+    bool release_geometry = false;
+    // Build once the cells with the same shapes (up to a translation) and emit the others as aliases of it
+    bool alias_identical_cells = false;
+    // Reuse the triangulation of the polygons that are translated copies of one triangulated before (vias, contacts, ...)
+    bool shape_cache = false;
+};
+process_options g_process_options;
 
-template <typename T>
-struct GrowBuffer
+// Maps the gdstk coordinates to the emitted positions
+// When quantized, XY are integer steps of the database precision relative to origin and Z is the index in the mesh z_levels.
+// They are written as int32 in the position slots (int32Position), so they stay exact up to 2^31 steps
+struct positions_transform
 {
-    int expansion_size = 1024 * 1024;
-    int current_offset = 0;
-    int allocated_size = 0;
-    int items_count = 0;
-    unsigned char *data = NULL;
+    double origin_x = 0;
+    double origin_y = 0;
+    double step = 1;
+    bool quantized = false;
 
-    GrowBuffer(int reserveBufferSize)
+    int64_t stepsX(double value) const
     {
-        assert(reserveBufferSize > 0);
-        data = (unsigned char *)malloc(reserveBufferSize);
-        assert(data);
-        allocated_size = reserveBufferSize;
-        current_offset = 0;
-        items_count = 0;
+        return llround((value - origin_x) / step);
     }
-    ~GrowBuffer()
+    int64_t stepsY(double value) const
     {
-        if (data != NULL)
-            free(data);
+        return llround((value - origin_y) / step);
     }
-    GrowBuffer(const GrowBuffer &temp_obj) = delete;
-    GrowBuffer &operator=(const GrowBuffer &temp_obj) = delete;
 
-    // Clear the current offsets but doesn't free the memory
-    void reset()
+    POSITIONS_TYPE x(double value) const
     {
-        current_offset = 0;
-        items_count = 0;
+        return quantized ? int32Position(stepsX(value)) : (POSITIONS_TYPE)value;
     }
-
-    int size()
+    POSITIONS_TYPE y(double value) const
     {
-        return items_count;
+        return quantized ? int32Position(stepsY(value)) : (POSITIONS_TYPE)value;
     }
-
-    void insert(T value)
+    // The layer z, or its z_levels index (0 for zmin, 1 for zmax) when quantized
+    POSITIONS_TYPE z(float value, int32_t z_level) const
     {
-        if (current_offset + sizeof(value) > allocated_size)
-        {
-            // expand
-            data = (unsigned char *)realloc(data, allocated_size + expansion_size);
-            assert(data);
-            allocated_size += expansion_size;
-        }
+        return quantized ? int32Position(z_level) : (POSITIONS_TYPE)value;
+    }
 
-        memcpy(data + current_offset, &value, sizeof(value));
-        current_offset += sizeof(value);
-        items_count++;
+    static POSITIONS_TYPE int32Position(int64_t value)
+    {
+        const int32_t bits = (int32_t)value;
+        POSITIONS_TYPE position;
+        memcpy(&position, &bits, sizeof(position));
+        return position;
     }
 };
 
-struct
+// Bounding box min and max of each cell (same order as g_lib.cell_array), calculated in processGDS
+static Array<Vec2> g_cells_origin = {};
+static Array<Vec2> g_cells_max = {};
+static Cell *g_top_cell = NULL;
+
+// Cells whose meshes were already emitted by processCells or processRegion (same order as g_lib.cell_array)
+static std::vector<bool> g_cells_emitted;
+// Cells whose shapes and labels were freed by the release_geometry option
+static std::vector<bool> g_cells_released;
+// Library info of processGDS, sent again to JS_gds_stats with the memory after processCells
+static gdstk::LibraryInfo g_lib_info = {};
+// Groups of identical cells (alias_identical_cells), found on the first processCells or processRegion after processGDS
+static cell_aliases g_cell_aliases;
+static bool g_cell_aliases_built = false;
+// Top cell placements for processRegion, built on its first call after processGDS
+static placements_index g_placements;
+static bool g_placements_built = false;
+// Index in g_lib.cell_array of each cell, built by processGDS
+static std::unordered_map<const Cell *, uint64_t> g_cells_idx;
+
+struct triangulation_stats
 {
     uint64_t total_vertices = 0;
     uint64_t total_triangles = 0;
-} g_triangulation_stats;
-
-struct layer_stack_data
-{
-    Tag tag;
-    char name[255];
-    double zmin;
-    double zmax;
-    layer_stack_data(Tag tag, const char *name, double zmin, double zmax) : tag(tag), zmin(zmin), zmax(zmax)
-    {
-        strncpy(this->name, name, 255);
-        this->name[255 - 1] = '\0';
-    }
+    // Triangles left out by cull_hidden_faces
+    uint64_t culled_triangles = 0;
+    // Polygons found or not in the shape cache (shape_cache)
+    uint64_t shape_cache_hits = 0;
+    uint64_t shape_cache_misses = 0;
 };
+triangulation_stats g_triangulation_stats;
+
+static triangulation_cache g_triangulation_cache;
+
+bool isRectangle(const Polygon *poly);
+void triangulate(Array<Polygon *> &polygons, const layer_triangulation &triangulation, GrowBuffer<POSITIONS_TYPE> &positions_buffer, GrowBuffer<INDICES_TYPE> &indices_buffer, POSITIONS_TYPE zmin, POSITIONS_TYPE zmax, const positions_transform &transform, const hidden_faces *hidden, triangulation_stats &stats);
+void createLineBuffers(Array<Polygon *> &polygons, GrowBuffer<POSITIONS_TYPE> &positions_buffer, GrowBuffer<INDICES_TYPE> &indices_buffer, POSITIONS_TYPE zmin, POSITIONS_TYPE zmax, const positions_transform &transform);
+void shareVertices(GrowBuffer<POSITIONS_TYPE> &positions_buffer, GrowBuffer<INDICES_TYPE> &indices_buffer);
+void addCellMesh(GrowBuffer<unsigned char> &cell_meshes, uint32_t layer_idx, uint32_t lod_level, float lod_max_screen_size, GrowBuffer<POSITIONS_TYPE> &positions_buffer, GrowBuffer<INDICES_TYPE> &indices_buffer);
+void processReferencesHierarchy(Library &lib);
 
 // layer_stack_data layer_stack[] = {
 //     {make_tag(235, 4), "substrate", -2, 0},
@@ -135,87 +167,6 @@ struct layer_stack_data
 
 // };
 
-void JS_gds_info_log(const char *format, ...)
-{
-    va_list args;
-    va_start(args, format);
-
-    time_t now = clock();
-    double elapsed_time = ((double)(now - g_start_time)) / CLOCKS_PER_SEC;
-
-    vsprintf(g_log_msg_buffer, format, args);
-    EM_ASM({ self.gds_info_log(UTF8ToString($0), $1); }, g_log_msg_buffer, elapsed_time);
-
-    va_end(args);
-}
-
-void JS_gds_stats(const char *design_name, LibraryInfo &info)
-{
-    EM_ASM(
-        { (
-              var design_name = UTF8ToString($0);
-              var stats = {
-                  designs : $1,
-                  shape_tags : $2,
-                  label_tags : $3,
-                  num_polygons : $4,
-                  num_paths : $5,
-                  num_references : $6,
-                  num_labels : $7,
-                  unit : $8,
-                  precision : $9
-              };
-
-              gds_stats(design_name, stats);) },
-        design_name,
-        info.cell_names.count,
-        info.shape_tags.count,
-        info.label_tags.count,
-        info.num_polygons,
-        info.num_paths,
-        info.num_references,
-        info.num_labels,
-        info.unit,
-        info.precision);
-}
-
-void JS_gds_add_cell(const char *cell_name, Vec2 &min, Vec2 &max, bool is_top_cell)
-{
-    EM_ASM({ (
-                 let bounds = {min_x : $1, min_y : $2, max_x : $3, max_y : $4};
-                 gds_add_cell(UTF8ToString($0), bounds, $5);) }, cell_name, min.x, min.y, max.x, max.y, is_top_cell);
-}
-
-void JS_gds_add_mesh(const char *cell_name, const char *mesh_name, int tag_layer, int tag_type, GrowBuffer<POSITIONS_TYPE> &positions, GrowBuffer<INDICES_TYPE> &indices)
-{
-    EM_ASM({ gds_add_mesh(UTF8ToString($0), UTF8ToString($1), $2, $3, $4, $5, $6, $7, $8); }, cell_name, mesh_name, tag_layer, tag_type, positions.size(), positions.data, indices.size(), indices.data);
-}
-
-void JS_gds_add_lines(const char *cell_name, const char *mesh_name, int tag_layer, int tag_type, GrowBuffer<POSITIONS_TYPE> &positions, GrowBuffer<INDICES_TYPE> &indices)
-{
-    EM_ASM({ gds_add_lines(UTF8ToString($0), UTF8ToString($1), $2, $3, $4, $5, $6, $7, $8); }, cell_name, mesh_name, tag_layer, tag_type, positions.size(), positions.data, indices.size(), indices.data);
-}
-
-void JS_gds_add_label(const char *cell_name, int tag_layer, int tag_type, const char *text, double origin_x, double origin_y, double pos_z)
-{
-    EM_ASM({ gds_add_label(UTF8ToString($0), $1, $2, UTF8ToString($3), $4, $5, $6); }, cell_name, tag_layer, tag_type, text, origin_x, origin_y, pos_z);
-}
-
-void JS_gds_add_reference(const char *parent_cell_name, const char *cell_name, const char *instance_name, double origin_x, double origin_y, double rotation, bool x_reflection)
-{
-    EM_ASM({gds_add_reference(UTF8ToString($0), UTF8ToString($1), UTF8ToString($2), $3, $4, $5, $6)}, parent_cell_name, cell_name, instance_name, origin_x, origin_y, rotation, x_reflection);
-}
-
-void JS_gds_finished_references()
-{
-    EM_ASM({ gds_finished_references(); });
-}
-
-void JS_gds_process_progress(float progress)
-{
-    EM_ASM({gds_process_progress($0)}, progress);
-}
-
 void buildMeshName(char *mesh_name, const char *cell_name, const char *layer_name)
 {
     sprintf(mesh_name, "%s_%s", cell_name, layer_name);
@@ -238,6 +189,44 @@ void print_gds_info(gdstk::LibraryInfo &lib_info)
     JS_gds_info_log("\n");
 }
 
+// Same counters gds_info gets from a GDS file, taken from the library already read (GDS or OASIS), so the file is parsed once
+// Paths count once per path, like a PATH record. The cell names are copies, info.clear() frees them
+void collectLibraryInfo(const Library &lib, LibraryInfo &info)
+{
+    info.unit = lib.unit;
+    info.precision = lib.precision;
+
+    for (uint64_t i = 0; i < lib.cell_array.count; i++)
+    {
+        const Cell *cell = lib.cell_array[i];
+        info.cell_names.append(copy_string(cell->name, NULL));
+
+        info.num_polygons += cell->polygon_array.count;
+        for (uint64_t j = 0; j < cell->polygon_array.count; j++)
+            info.shape_tags.add(cell->polygon_array[j]->tag);
+
+        info.num_paths += cell->flexpath_array.count + cell->robustpath_array.count;
+        for (uint64_t j = 0; j < cell->flexpath_array.count; j++)
+        {
+            const FlexPath *path = cell->flexpath_array[j];
+            for (uint64_t k = 0; k < path->num_elements; k++)
+                info.shape_tags.add(path->elements[k].tag);
+        }
+        for (uint64_t j = 0; j < cell->robustpath_array.count; j++)
+        {
+            const RobustPath *path = cell->robustpath_array[j];
+            for (uint64_t k = 0; k < path->num_elements; k++)
+                info.shape_tags.add(path->elements[k].tag);
+        }
+
+        info.num_references += cell->reference_array.count;
+
+        info.num_labels += cell->label_array.count;
+        for (uint64_t j = 0; j < cell->label_array.count; j++)
+            info.label_tags.add(cell->label_array[j]->tag);
+    }
+}
+
 bool check_extension_matches(const char *filename, const char *target_extension)
 {
     const int extension_length = strlen(target_extension);    
@@ -288,10 +277,92 @@ extern "C"
 
         JS_gds_info_log("Add process layer %d/%d - %s (zmin:%f zmax:%f)\n", layer_number, layer_datatype, name, layer_zmin, layer_zmax);
     }
+
+    // Removes all the process layers, to add a new layer stack before processing the cells again (see resetProcessedCells)
+    EMSCRIPTEN_KEEPALIVE
+    void clearProcessLayers()
+    {
+        g_layer_stack.clear();
+        JS_gds_info_log("Clear process layers\n");
+    }
+
+    EMSCRIPTEN_KEEPALIVE
+    void setProcessOption(const char *name, double value)
+    {
+        if (strcmp(name, "threads") == 0)
+        {
+            g_process_options.threads = value < 1 ? 1 : (uint32_t)value;
+            if (g_process_options.threads > maxJobThreads())
+                JS_gds_info_log("Process option threads: %u requested, this build can use %u\n", g_process_options.threads, maxJobThreads());
+        }
+        else if (strcmp(name, "shared_vertices") == 0)
+        {
+            g_process_options.shared_vertices = value != 0;
+        }
+        else if (strcmp(name, "quantized_positions") == 0)
+        {
+            g_process_options.quantized_positions = value != 0;
+        }
+        else if (strcmp(name, "merge_layers") == 0)
+        {
+            // Merged polygons are triangulated differently
+            if (g_process_options.merge_layers != (value != 0))
+                g_triangulation_cache.clear();
+            g_process_options.merge_layers = value != 0;
+        }
+        else if (strcmp(name, "cull_hidden_faces") == 0)
+        {
+            g_process_options.cull_hidden_faces = value != 0;
+        }
+        else if (strcmp(name, "triangulation_cache") == 0)
+        {
+            g_process_options.triangulation_cache = value != 0;
+            if (!g_process_options.triangulation_cache)
+                g_triangulation_cache.clear();
+        }
+        else if (strcmp(name, "progressive_emission") == 0)
+        {
+            g_process_options.progressive_emission = value != 0;
+        }
+        else if (strcmp(name, "release_geometry") == 0)
+        {
+            g_process_options.release_geometry = value != 0;
+        }
+        else if (strcmp(name, "alias_identical_cells") == 0)
+        {
+            g_process_options.alias_identical_cells = value != 0;
+        }
+        else if (strcmp(name, "shape_cache") == 0)
+        {
+            g_process_options.shape_cache = value != 0;
+        }
+        else if (strcmp(name, "log_cells") == 0)
+        {
+            g_process_options.log_cells = value != 0;
+        }
+        else if (strcmp(name, "trace") == 0)
+        {
+            // Recording starts again, processGDS restarts it too
+            g_trace_enabled = value != 0;
+            traceReset();
+        }
+        else if (strcmp(name, "lod_levels") == 0)
+        {
+            g_process_options.lod_levels = value < 0 ? 0 : std::min((uint32_t)value, MAX_LOD_LEVELS);
+        }
+        else
+        {
+            JS_gds_info_log("Unknown process option: %s\n", name);
+            return;
+        }
+
+        JS_gds_info_log("Process option %s: %f\n", name, value);
+    }
 }
 
 extern "C"
 {
+    // The file is only read here, the worker removes it from MEMFS when this returns
     EMSCRIPTEN_KEEPALIVE
     void processGDS(const char *gds_filepath, bool opt_just_lines = false)
     {
@@ -299,36 +370,54 @@ extern "C"
 
         // JS_TEST_ASM();
 
+        if (g_trace_enabled)
+            traceReset();
+
         JS_gds_info_log("Starting process: %s\n", gds_filepath);
         JS_gds_info_log("\topt_just_lines: %d\n", opt_just_lines);
         JS_gds_process_progress(0);
 
-        g_lib.clear();
+        // The cells of the previous file are freed too
+        g_lib.free_all();
+        g_lib_info.clear();
 
-        gdstk::LibraryInfo lib_info = {};
+        uint64_t file_size = 0;
+        FILE *file = fopen(gds_filepath, "rb");
+        if (file != NULL)
+        {
+            fseek(file, 0, SEEK_END);
+            file_size = (uint64_t)ftell(file);
+            fclose(file);
+        }
+        clock_t read_start_time = clock();
 
-        if(check_extension_matches(gds_filepath, "gds"))
-        {        
-            gdstk::gds_info(gds_filepath, lib_info);
-            print_gds_info(lib_info);
-            JS_gds_process_progress(1);
-            g_lib = read_gds(gds_filepath, 0, 0, NULL, NULL);
-        } 
-        else 
         {
-            g_lib = read_oas(gds_filepath, 0, 0, NULL);
+            trace_scope scope(TRACE_PARSE);
+            if (check_extension_matches(gds_filepath, "gds"))
+            {
+                g_lib = read_gds(gds_filepath, 0, 0, NULL, NULL);
+            }
+            else
+            {
+                g_lib = read_oas(gds_filepath, 0, 0, NULL);
+            }
         }
 
-        
-        JS_gds_process_progress(5);
+        const double read_seconds = (double)(clock() - read_start_time) / CLOCKS_PER_SEC;
+        JS_gds_info_log("Read %" PRIu64 " bytes in %.3f s (%.1f MB/s)\n", file_size, read_seconds, read_seconds > 0 ? file_size / (1024.0 * 1024.0) / read_seconds : 0);
+        JS_gds_process_progress(1);
+
+        collectLibraryInfo(g_lib, g_lib_info);
+        print_gds_info(g_lib_info);
 
         Array<Cell *> top_cells = {};
         Array<RawCell *> top_rawcells = {};
 
         g_lib.top_level(top_cells, top_rawcells);
         Cell *top_cell = top_cells[0];
+        g_top_cell = top_cell;
 
-        JS_gds_stats(top_cell->name, lib_info);
+        JS_gds_stats(top_cell->name, g_lib_info, getMemoryStats());
         
         JS_gds_info_log("TOP_CELL: %s\n", top_cell->name);
         JS_gds_info_log("references: %" PRIu64 "\n", top_cell->reference_array.count);
@@ -338,503 +427,1788 @@ extern "C"
         // cell->flatten(true, removed_references);
 
         JS_gds_info_log("Start boundingbox calculation\n");
-        for (uint64_t i = 0; i < g_lib.cell_array.count; i++)
         {
-            Vec2 min;
-            Vec2 max;
-            g_lib.cell_array[i]->bounding_box(min, max);
-
-            bool is_top_cell = (top_cells.index(g_lib.cell_array[i]) != top_cells.count);
-            JS_gds_add_cell(g_lib.cell_array[i]->name, min, max, is_top_cell);
+            trace_scope scope(TRACE_BOUNDING_BOXES);
+            g_cells_origin.clear();
+            g_cells_max.clear();
+            for (uint64_t i = 0; i < g_lib.cell_array.count; i++)
+            {
+                Vec2 min;
+                Vec2 max;
+                g_lib.cell_array[i]->bounding_box(min, max);
+                // Empty cells have an inverted bounding box
+                g_cells_origin.append(min.x <= max.x ? min : Vec2{0, 0});
+                g_cells_max.append(min.x <= max.x ? max : Vec2{0, 0});
+
+                bool is_top_cell = (top_cells.index(g_lib.cell_array[i]) != top_cells.count);
+                JS_gds_add_cell(g_lib.cell_array[i]->name, min, max, is_top_cell);
+
+                // Bounding boxes go from 1% to 5%, reported when the whole percent changes
+                if ((uint64_t)(4 * (i + 1) / g_lib.cell_array.count) != (uint64_t)(4 * i / g_lib.cell_array.count))
+                    JS_gds_process_progress(1 + 4 * (i + 1) / (float)g_lib.cell_array.count);
+            }
         }
         JS_gds_info_log("Finished boundingbox calculation\n");
 
+        top_cells.clear();
+        top_rawcells.clear();
+
+        g_cells_emitted.assign(g_lib.cell_array.count, false);
+        g_cells_released.assign(g_lib.cell_array.count, false);
+        g_cells_idx.clear();
+        for (uint64_t i = 0; i < g_lib.cell_array.count; i++)
+            g_cells_idx[g_lib.cell_array[i]] = i;
+        g_triangulation_cache.clear();
+        shape_triangulation_cache::clearAll();
+        g_placements.clear();
+        g_placements_built = false;
+        g_cell_aliases.clear();
+        g_cell_aliases_built = false;
+
         JS_gds_info_log("Start processing references\n");
         processReferencesHierarchy(g_lib);
         JS_gds_info_log("Finished processing references\n");
     }
 }
 
-extern "C"
+// Polygons of one (cell, layer)
+// The cell polygons are used in place. Only the ones made for repetitions and paths are allocated (owned), clear() frees them
+// and keeps the arrays capacity for the next layer
+struct layer_polygons
 {
+    Array<Polygon *> polygons = {};
+    Array<Polygon *> owned = {};
 
-    EMSCRIPTEN_KEEPALIVE
-    void processCells(bool opt_just_lines = false)
+    void addOwned(Polygon *poly)
     {
-        GrowBuffer<POSITIONS_TYPE> positions_buffer(1024 * 1024);
-        GrowBuffer<INDICES_TYPE> indices_buffer(1024 * 1024);
-
-        Array<Polygon *> polygons = {};
-        Array<Polygon *> polygons_copy = {};
-
-        constexpr int depth = 0;
+        polygons.append(poly);
+        owned.append(poly);
+    }
 
-        JS_gds_info_log("Start processing cell\n");
-        for (uint64_t i = 0; i < g_lib.cell_array.count; i++)
+    void clear()
+    {
+        for (uint64_t i = 0; i < owned.count; i++)
         {
-            auto cell = g_lib.cell_array[i];
-            JS_gds_info_log("Cell: %s\n", cell->name);
-            JS_gds_info_log("\trefs: %" PRIu64 "\n", cell->reference_array.count);
+            owned[i]->clear();
+            free_allocation(owned[i]);
+        }
+        owned.count = 0;
+        polygons.count = 0;
+    }
 
-            // LOOP LAYERS IN CELL
-            int layers_count = g_layer_stack.count;
-            for (int layer_idx = 0; layer_idx < layers_count; layer_idx++)
-            {
-                const Tag tag = g_layer_stack[layer_idx].tag;
+    void free()
+    {
+        clear();
+        polygons.clear();
+        owned.clear();
+    }
+};
 
-                cell->get_polygons(true, true, depth, true, tag, polygons);
+// Distinct tags of g_layer_stack (tag -> slot) and the slot of each layer. Built by processCells
+static std::unordered_map<Tag, uint32_t> g_tag_slots;
+static std::vector<uint32_t> g_layer_slots;
 
-#ifdef TEST_MERGE_SAME_LAYER_POLYS
-                {
-                    Array<Polygon *> res_poly = {};
-                    boolean(polygons, polygons, Operation::Or, 1000, res_poly);
-                    polygons.clear();
-                    polygons = res_poly;
-                }
-#endif
+void buildLayerTagSlots()
+{
+    g_tag_slots.clear();
+    g_layer_slots.clear();
+    for (uint64_t i = 0; i < g_layer_stack.count; i++)
+    {
+        auto it = g_tag_slots.emplace(g_layer_stack[i].tag, (uint32_t)g_tag_slots.size()).first;
+        g_layer_slots.push_back(it->second);
+    }
+}
 
-                if (polygons.count > 0)
-                {
-                    JS_gds_info_log("\t\tLayer: %d/%d\n", gdstk::get_layer(tag), gdstk::get_type(tag));
-                    JS_gds_info_log("\t\t\tpolygons: %" PRIu64 "\n", polygons.count);
+static inline uint32_t tagSlot(Tag tag)
+{
+    auto it = g_tag_slots.find(tag);
+    return it == g_tag_slots.end() ? UINT32_MAX : it->second;
+}
 
-                    char mesh_name[1024];
-                    buildMeshName(mesh_name, cell->name, g_layer_stack[layer_idx].name);
+// Shapes of one cell grouped by tag slot, built in a single pass over its polygons and paths
+// Shapes with a tag that isn't in the layer stack are left out
+struct cell_shapes_index
+{
+    enum shape_type : uint8_t
+    {
+        SHAPE_POLYGON,
+        SHAPE_PATH
+    };
 
-                    if (opt_just_lines)
-                    {
-                        // Lines
-                        createLineBuffers(polygons, positions_buffer, indices_buffer, g_layer_stack[layer_idx].zmin, g_layer_stack[layer_idx].zmax);
-                        JS_gds_add_lines(cell->name, mesh_name, gdstk::get_layer(tag), gdstk::get_type(tag), positions_buffer, indices_buffer);
-                    }
-                    else
-                    {
-                        // Triangles
-                        triangulate(polygons, positions_buffer, indices_buffer, g_layer_stack[layer_idx].zmin, g_layer_stack[layer_idx].zmax);
-                        JS_gds_add_mesh(cell->name, mesh_name, gdstk::get_layer(tag), gdstk::get_type(tag), positions_buffer, indices_buffer);
-                    }
-                }
-                polygons.clear();
-            }
+    struct shape
+    {
+        shape_type type;
+        Polygon *polygon;
+    };
+
+    // Shapes of slot s are shapes[slot_begin[s] .. slot_begin[s + 1]), in the cell order (polygons, flexpaths, robustpaths)
+    std::vector<uint32_t> slot_begin;
+    std::vector<shape> shapes;
+    // Polygons of the paths, converted once for the cell: to_polygons can change the path (it removes overlapping points),
+    // so the layer jobs can't call it concurrently
+    layer_polygons path_polygons;
+
+    uint32_t count(uint32_t slot) const
+    {
+        return slot_begin[slot + 1] - slot_begin[slot];
+    }
 
-            // TEST:
-            // {
-            //     JS_gds_info_log("\t\tTEST Negative Meshes\n");
-            //     Array<Polygon *> substrate_polys = {};
-            //     Array<Polygon *> result_polys = {};
-            //     Vec2 min;
-            //     Vec2 max;
-            //     char mesh_name[1024];
-            //     float zmin;
-            //     float zmax;
-            //     int new_tag_layer = 0;
-            //     int new_tag_datatype = 0;                
-            //     cell->bounding_box(min, max);            
-            //     Polygon p = {};
-            //     p.point_array.append({min.x, min.y});
-            //     p.point_array.append({min.x, max.y});
-            //     p.point_array.append({max.x, max.y});
-            //     p.point_array.append({max.x, min.y});
-            //     substrate_polys.append(&p);
-
-            //     result_polys.clear();
-            //     const Tag poly_tag = make_tag(66, 20);                
-            //     Array<Polygon *> poly_polys = {};                
-            //     cell->get_polygons(true, true, depth, true, poly_tag, poly_polys);
-            //     boolean(substrate_polys, poly_polys, Operation::Not, 1000, result_polys);
-            //     buildMeshName(mesh_name, cell->name, "substrate-poly");
-            //     // Triangles
-            //     zmin = 0.0;
-            //     zmax = 0.18;
-            //     triangulate(result_polys, positions_buffer, indices_buffer, zmin, zmax);
-            //     JS_gds_add_mesh(cell->name, mesh_name, new_tag_layer, new_tag_datatype, positions_buffer, indices_buffer);
-
-            //     result_polys.clear();
-            //     const Tag licon_tag = make_tag(66, 44);                
-            //     Array<Polygon *> licon_polys = {};                
-            //     cell->get_polygons(true, true, depth, true, licon_tag, licon_polys);
-            //     boolean(substrate_polys, licon_polys, Operation::Not, 1000, result_polys);                
-            //     buildMeshName(mesh_name, cell->name, "substrate-licon");
-            //     // Triangles
-            //     zmin = 0.0;
-            //     zmax = 0.936;
-            //     triangulate(result_polys, positions_buffer, indices_buffer, zmin, zmax);
-            //     JS_gds_add_mesh(cell->name, mesh_name, new_tag_layer, new_tag_datatype, positions_buffer, indices_buffer);
-
-            //     result_polys.clear();
-            //     const Tag li1_tag = make_tag(67, 20);                
-            //     Array<Polygon *> li1_polys = {};                
-            //     cell->get_polygons(true, true, depth, true, li1_tag, li1_polys);
-            //     boolean(substrate_polys, li1_polys, Operation::Not, 1000, result_polys);                
-            //     buildMeshName(mesh_name, cell->name, "substrate-li1");
-            //     // Triangles
-            //     zmin = 0.936;
-            //     zmax = 1.136;
-            //     triangulate(result_polys, positions_buffer, indices_buffer, zmin, zmax);
-            //     JS_gds_add_mesh(cell->name, mesh_name, new_tag_layer, new_tag_datatype, positions_buffer, indices_buffer);
-
-            //     result_polys.clear();
-            //     const Tag mcon_tag = make_tag(67, 44);                
-            //     Array<Polygon *> mcon_polys = {};                
-            //     cell->get_polygons(true, true, depth, true, mcon_tag, mcon_polys);
-            //     boolean(substrate_polys, mcon_polys, Operation::Not, 1000, result_polys);                
-            //     buildMeshName(mesh_name, cell->name, "substrate-mcon");
-            //     // Triangles
-            //     zmin = 1.011;
-            //     zmax = 1.376;
-            //     triangulate(result_polys, positions_buffer, indices_buffer, zmin, zmax);
-            //     JS_gds_add_mesh(cell->name, mesh_name, new_tag_layer, new_tag_datatype, positions_buffer, indices_buffer);               
-
-            // }
-
-            // LABELS
-            
-            const Tag label_layers[] = {make_tag(67, 5), make_tag(68, 5), make_tag(69, 5), make_tag(70, 5), make_tag(71, 5), make_tag(72, 5)};
-            const double label_layers_heights[] = {1.136 + 0.03, 1.736 + 0.03, 2.36 + 0.03, 3.631 + 0.03, 4.8661 + 0.03, 6.6311 + 0.03};
-            Array<Label *> labels = {};
-
-            for (int layer_idx = 0; layer_idx < ARRAY_LENGTH(label_layers); layer_idx++)
-            {
-                const Tag tag = label_layers[layer_idx];
-                const double pos_z = label_layers_heights[layer_idx];
+    void free()
+    {
+        path_polygons.free();
+    }
+};
 
-                cell->get_labels(true, depth, true, tag, labels);
+// Converts the elements of a path that are in some slot, once per tag
+template <typename P>
+static inline void addPathPolygons(P *path, layer_polygons &result)
+{
+    for (uint64_t i = 0; i < path->num_elements; i++)
+    {
+        const Tag tag = path->elements[i].tag;
+        if (tagSlot(tag) == UINT32_MAX)
+            continue;
+
+        bool repeated = false;
+        for (uint64_t j = 0; j < i && !repeated; j++)
+            repeated = path->elements[j].tag == tag;
+        if (repeated)
+            continue;
+
+        const uint64_t path_begin = result.polygons.count;
+        path->to_polygons(true, tag, result.polygons);
+        for (uint64_t j = path_begin; j < result.polygons.count; j++)
+            result.owned.append(result.polygons[j]);
+    }
+}
 
-                for (uint64_t i = 0; i < labels.count; i++)
-                {
-                    auto label = labels[i];
-                    JS_gds_add_label(cell->name, gdstk::get_layer(label->tag), gdstk::get_type(label->tag), label->text, label->origin.x, label->origin.y, pos_z);
-                }
+// Without with_paths only the cell polygons are indexed (paths are not converted)
+void buildCellShapesIndex(Cell *cell, cell_shapes_index &index, bool with_paths = true)
+{
+    trace_scope scope(TRACE_POLYGONS);
 
-                labels.clear();
-            }
+    index.path_polygons.clear();
+    if (with_paths)
+    {
+        for (uint64_t i = 0; i < cell->flexpath_array.count; i++)
+            addPathPolygons(cell->flexpath_array[i], index.path_polygons);
+        for (uint64_t i = 0; i < cell->robustpath_array.count; i++)
+            addPathPolygons(cell->robustpath_array[i], index.path_polygons);
+    }
+    const Array<Polygon *> &path_polygons = index.path_polygons.polygons;
 
-            float perc = (i + 1) / (float)(g_lib.cell_array.count);
-            perc = perc * 95 + 5;
-            JS_gds_process_progress(perc);
-        }
+    // Counting sort: counts go to slot_begin[s + 2], so after the prefix sum slot_begin[s + 1] is where slot s starts,
+    // and after filling (incrementing it) where slot s ends, which is where s + 1 starts
+    const uint64_t slots_count = g_tag_slots.size();
+    index.slot_begin.assign(slots_count + 2, 0);
 
-        JS_gds_info_log("Finished processing cell\n");
+    for (uint64_t i = 0; i < cell->polygon_array.count; i++)
+    {
+        const uint32_t slot = tagSlot(cell->polygon_array[i]->tag);
+        if (slot != UINT32_MAX)
+            index.slot_begin[slot + 2]++;
+    }
+    for (uint64_t i = 0; i < path_polygons.count; i++)
+        index.slot_begin[tagSlot(path_polygons[i]->tag) + 2]++;
 
-        JS_gds_info_log("Triangulation stats: total_vertices: %" PRIu64 " total_triangles: %" PRIu64 "\n", g_triangulation_stats.total_vertices, g_triangulation_stats.total_triangles);
+    for (uint64_t s = 2; s < slots_count + 2; s++)
+        index.slot_begin[s] += index.slot_begin[s - 1];
+    index.shapes.resize(index.slot_begin[slots_count + 1]);
 
-        JS_gds_process_progress(100);
+    for (uint64_t i = 0; i < cell->polygon_array.count; i++)
+    {
+        const uint32_t slot = tagSlot(cell->polygon_array[i]->tag);
+        if (slot != UINT32_MAX)
+            index.shapes[index.slot_begin[slot + 1]++] = {cell_shapes_index::SHAPE_POLYGON, cell->polygon_array[i]};
     }
+    for (uint64_t i = 0; i < path_polygons.count; i++)
+        index.shapes[index.slot_begin[tagSlot(path_polygons[i]->tag) + 1]++] = {cell_shapes_index::SHAPE_PATH, path_polygons[i]};
 }
 
-void processReferencesHierarchy(Library &lib)
+// Same polygons as cell->get_polygons(true, true, 0, true, tag, ...), without copying the ones that have no repetition
+void getCellLayerPolygons(const cell_shapes_index &index, uint32_t slot, layer_polygons &result)
 {
-
-    for (int i = 0; i < lib.cell_array.count; i++)
+    trace_scope scope(TRACE_POLYGONS);
+    for (uint32_t i = index.slot_begin[slot]; i < index.slot_begin[slot + 1]; i++)
     {
-        auto cell = lib.cell_array[i];
-
-        for (int j = 0; j < cell->reference_array.count; j++)
+        Polygon *poly = index.shapes[i].polygon;
+        if (poly->repetition.type == RepetitionType::None)
         {
-            Reference *ref = cell->reference_array[j];
-
-            const char *child_instance_name;
-
-            // ToDo: 61 seems to be the property on sky130, but not in others?
-            // For now we use the first GDS property we found as the instance name
-            // properties_print(ref->properties);
-            // auto *gds_instance_name_prop = gdstk::get_gds_property(ref->properties, 61);
-            auto *gds_instance_name_prop = GDSTKUTIL_get_first_gds_property(ref->properties);            
-            if (gds_instance_name_prop == NULL)
-                child_instance_name = "???";
-            else
-                child_instance_name = (char *)gds_instance_name_prop->bytes;
-
-            if (ref->repetition.type != RepetitionType::None)
-            {
-                Array<Vec2> offsets = {};
-                ref->repetition.get_offsets(offsets);
-                // repetition.clear();
-
-                // double *offset_p = (double *)(offsets.items + 1);
-                double *offset_p = (double *)(offsets.items);
-                // double origin_x = ref->origin.x;
-                // double origin_y = ref->origin.y;
-                // result.ensure_slots(offsets.count - 1);
-                for (uint64_t offset_count = offsets.count; offset_count > 0; offset_count--)
-                {
-                    double origin_x = ref->origin.x + *offset_p++;
-                    double origin_y = ref->origin.y + *offset_p++;
-                    // if (ref->type == ReferenceType::Cell && ref->cell->reference_array.count > 0)
-                    // ToDo: contemplate case where ReferenceType is RawCell or just name
-                    // ToDo: put a name to the array instances (use col and row indexes?)
-                    JS_gds_add_reference(cell->name, ref->cell->name, child_instance_name, origin_x, origin_y, ref->rotation, ref->x_reflection);
-                }
-
-                offsets.clear();
-            }
-            else
-            {
-                // if (ref->type == ReferenceType::Cell && ref->cell->reference_array.count > 0)
-                // ToDo: contemplate case where ReferenceType is RawCell or just name
-                JS_gds_add_reference(cell->name, ref->cell->name, child_instance_name, ref->origin.x, ref->origin.y, ref->rotation, ref->x_reflection);
-            }
+            result.polygons.append(poly);
+            continue;
         }
+
+        // apply_repetition clears the repetition of the polygon, so it works on a copy
+        Polygon *copy = (Polygon *)allocate_clear(sizeof(Polygon));
+        copy->copy_from(*poly);
+        const uint64_t first_repeated = result.polygons.count + 1;
+        result.addOwned(copy);
+        copy->apply_repetition(result.polygons);
+        for (uint64_t j = first_repeated; j < result.polygons.count; j++)
+            result.owned.append(result.polygons[j]);
     }
+}
 
-    JS_gds_finished_references();
+// Scale of the boolean operations grid: the database precision
+double mergeScaling()
+{
+    return g_lib.unit > 0 && g_lib.precision > 0 ? g_lib.unit / g_lib.precision : 1000;
 }
 
-void triangulate(Array<Polygon *> &polygons, GrowBuffer<POSITIONS_TYPE> &positions_buffer, GrowBuffer<INDICES_TYPE> &indices_buffer, float zmin, float zmax)
+// Replaces the layer polygons with the merged ones
+void finishLayerMerge(layer_merge &merge, layer_polygons &layer_polys)
 {
-    uint64_t total_triangles = 0;
-    uint64_t total_vertices = 0;
+    Array<Polygon *> merged = {};
+    merge.finish(merged);
 
-    int indices_offset = 0;
-    // std::vector<float> mesh_points_pos;
-    // std::vector<uint32_t> mesh_indices;
-    positions_buffer.reset();
-    indices_buffer.reset();
+    layer_polys.clear();
+    for (uint64_t i = 0; i < merged.count; i++)
+        layer_polys.addOwned(merged[i]);
+    merged.clear();
+}
 
+// True if the triangulation was built from the polygons that aren't rectangles, in the same order
+bool triangulationMatches(const layer_triangulation &triangulation, const Array<Polygon *> &polygons)
+{
+    uint64_t triangulated_idx = 0;
     for (uint64_t j = 0; j < polygons.count; j++)
     {
-        auto poly = polygons[j];
+        if (!isRectangle(polygons[j]) && !triangulation.matches(triangulated_idx++, polygons[j]))
+            return false;
+    }
+    return triangulated_idx == triangulation.polygons.size();
+}
 
-        // SOME TEST: Special case of rectangles (there are usually many more that other types of polygons, that's why is worth to handle them this way)
-        if (poly->point_array.count == 4 &&
-            ((poly->point_array[0].x == poly->point_array[1].x && poly->point_array[2].x == poly->point_array[3].x && poly->point_array[0].y == poly->point_array[3].y && poly->point_array[1].y == poly->point_array[2].y) ||
-             (poly->point_array[0].x == poly->point_array[3].x && poly->point_array[1].x == poly->point_array[2].x && poly->point_array[0].y == poly->point_array[1].y && poly->point_array[2].y == poly->point_array[3].y)))
-        {
+// 2D triangulation of the polygons of (cell, tag) that aren't rectangles, from the cache when the triangulation_cache option
+// is on and it was already built. With shape_cache, the copies of a polygon already triangulated by this thread reuse it
+const layer_triangulation &layerTriangulation(uint64_t cell_idx, Tag tag, const Array<Polygon *> &polygons, triangulation_stats &stats)
+{
+    trace_scope scope(TRACE_TRIANGULATION);
+    const layer_triangulation *cached = NULL;
+    if (g_process_options.triangulation_cache)
+    {
+        cached = g_triangulation_cache.find(cell_idx, tag);
+        if (cached != NULL && triangulationMatches(*cached, polygons))
+            return *cached;
+    }
 
-            constexpr int total_poly_vertices = 4;
+    thread_local layer_triangulation triangulation;
+    thread_local shape_triangulation_cache shapes;
+    triangulation.clear();
+    shapes.hits = shapes.misses = 0;
+    shapes.setStep(1 / mergeScaling());
+    uint64_t rectilinear_count = 0;
+    for (uint64_t j = 0; j < polygons.count; j++)
+    {
+        if (isRectangle(polygons[j]))
+            continue;
+        if (g_process_options.shape_cache && shapes.find(polygons[j], triangulation))
+            continue;
+        if (triangulation.add(polygons[j]))
+            rectilinear_count++;
+        if (g_process_options.shape_cache)
+            shapes.store(triangulation);
+    }
+    stats.shape_cache_hits += shapes.hits;
+    stats.shape_cache_misses += shapes.misses;
+    traceCount(TRACE_COUNTER_TRIANGULATED_POLYGONS, triangulation.polygons.size());
+    traceCount(TRACE_COUNTER_RECTILINEAR_POLYGONS, rectilinear_count);
+
+    // A cached one that doesn't match (polygons built with other options) is left as it is
+    if (g_process_options.triangulation_cache && !g_process_options.release_geometry && cached == NULL)
+        return *g_triangulation_cache.store(cell_idx, tag, triangulation);
+    return triangulation;
+}
 
-            // BOTTOM FACES
-            int bottom_indices_offset = indices_offset;
+// Builds the triangles (or lines) of the layer polygons in the given buffers, and frees the polygons
+// Doesn't emit anything, so it can run on any thread. Returns the number of polygons
+// lods: where the coarse levels of detail are built (triangles with the lod_levels option), or NULL
+uint64_t buildLayerMeshes(uint64_t cell_idx, layer_polygons &layer_polys, uint32_t layer_idx, bool opt_just_lines, const positions_transform &transform, layer_lods *lods, GrowBuffer<POSITIONS_TYPE> &positions_buffer, GrowBuffer<INDICES_TYPE> &indices_buffer, triangulation_stats &stats)
+{
+    const layer_stack_data &layer = g_layer_stack[layer_idx];
 
-            positions_buffer.insert((POSITIONS_TYPE)poly->point_array[0].x);
-            positions_buffer.insert((POSITIONS_TYPE)poly->point_array[0].y);
-            positions_buffer.insert((POSITIONS_TYPE)zmin);
+    Array<Polygon *> &polygons = layer_polys.polygons;
+    uint64_t polygons_count = polygons.count;
+    if (polygons_count > 0)
+    {
+        const POSITIONS_TYPE zmin = transform.z(layer.zmin, 0);
+        const POSITIONS_TYPE zmax = transform.z(layer.zmax, 1);
 
-            positions_buffer.insert((POSITIONS_TYPE)poly->point_array[1].x);
-            positions_buffer.insert((POSITIONS_TYPE)poly->point_array[1].y);
-            positions_buffer.insert((POSITIONS_TYPE)zmin);
+        if (opt_just_lines)
+        {
+            // Lines
+            createLineBuffers(polygons, positions_buffer, indices_buffer, zmin, zmax, transform);
+        }
+        else
+        {
+            // Triangles
+            thread_local hidden_faces hidden;
+            if (g_process_options.cull_hidden_faces)
+            {
+                trace_scope scope(TRACE_CULLING);
+                hidden.find(polygons);
+            }
+            const layer_triangulation &triangulation = layerTriangulation(cell_idx, layer.tag, polygons, stats);
+            triangulate(polygons, triangulation, positions_buffer, indices_buffer, zmin, zmax, transform, g_process_options.cull_hidden_faces ? &hidden : NULL, stats);
 
-            positions_buffer.insert((POSITIONS_TYPE)poly->point_array[2].x);
-            positions_buffer.insert((POSITIONS_TYPE)poly->point_array[2].y);
-            positions_buffer.insert((POSITIONS_TYPE)zmin);
+            if (lods != NULL)
+            {
+                trace_scope scope(TRACE_LODS);
+                lods->build(polygons, g_process_options.lod_levels, indices_buffer.size() / 3);
+            }
+        }
 
-            positions_buffer.insert((POSITIONS_TYPE)poly->point_array[3].x);
-            positions_buffer.insert((POSITIONS_TYPE)poly->point_array[3].y);
-            positions_buffer.insert((POSITIONS_TYPE)zmin);
+        if (g_process_options.shared_vertices)
+            shareVertices(positions_buffer, indices_buffer);
+    }
+    layer_polys.clear();
+    traceCount(TRACE_COUNTER_POLYGONS, polygons_count);
 
-            indices_buffer.insert((INDICES_TYPE)0 + indices_offset);
-            indices_buffer.insert((INDICES_TYPE)1 + indices_offset);
-            indices_buffer.insert((INDICES_TYPE)2 + indices_offset);
+    return polygons_count;
+}
 
-            indices_buffer.insert((INDICES_TYPE)0 + indices_offset);
-            indices_buffer.insert((INDICES_TYPE)2 + indices_offset);
-            indices_buffer.insert((INDICES_TYPE)3 + indices_offset);
+// Gets the polygons of one layer of a cell (merged, with the merge_layers option) and builds their meshes
+uint64_t buildCellLayer(uint64_t cell_idx, const cell_shapes_index &index, uint32_t layer_idx, bool opt_just_lines, const positions_transform &transform, layer_polygons &layer_polys, layer_merge &merge, layer_lods *lods, GrowBuffer<POSITIONS_TYPE> &positions_buffer, GrowBuffer<INDICES_TYPE> &indices_buffer, triangulation_stats &stats)
+{
+    getCellLayerPolygons(index, g_layer_slots[layer_idx], layer_polys);
 
-            indices_offset += total_poly_vertices;
+    if (g_process_options.merge_layers)
+    {
+        merge.prepare(layer_polys.polygons, mergeScaling());
+        for (uint32_t tile_idx = 0; tile_idx < merge.tilesCount(); tile_idx++)
+            merge.mergeTile(tile_idx);
+        finishLayerMerge(merge, layer_polys);
+    }
 
-            // TOP FACES
-            int top_indices_offset = indices_offset;
+    return buildLayerMeshes(cell_idx, layer_polys, layer_idx, opt_just_lines, transform, lods, positions_buffer, indices_buffer, stats);
+}
 
-            positions_buffer.insert((POSITIONS_TYPE)poly->point_array[0].x);
-            positions_buffer.insert((POSITIONS_TYPE)poly->point_array[0].y);
-            positions_buffer.insert((POSITIONS_TYPE)zmax);
+positions_transform cellPositionsTransform(uint64_t cell_idx)
+{
+    positions_transform transform;
+    if (g_process_options.quantized_positions && g_lib.unit > 0 && g_lib.precision > 0)
+    {
+        transform.origin_x = g_cells_origin[cell_idx].x;
+        transform.origin_y = g_cells_origin[cell_idx].y;
+        transform.step = g_lib.precision / g_lib.unit;
+        transform.quantized = true;
+    }
+    return transform;
+}
 
-            positions_buffer.insert((POSITIONS_TYPE)poly->point_array[1].x);
-            positions_buffer.insert((POSITIONS_TYPE)poly->point_array[1].y);
-            positions_buffer.insert((POSITIONS_TYPE)zmax);
+void beginCellMeshes(GrowBuffer<unsigned char> &cell_meshes, bool opt_just_lines, const positions_transform &transform)
+{
+    cell_meshes.reset();
+
+    cell_meshes_header header = {};
+    const uint32_t lod_levels = opt_just_lines ? 0 : g_process_options.lod_levels;
+    header.entries_capacity = g_layer_stack.count * (1 + lod_levels);
+    header.flags = opt_just_lines ? CELL_MESHES_FLAG_LINES : 0;
+    if (transform.quantized)
+        header.flags |= CELL_MESHES_FLAG_QUANTIZED;
+    header.origin_x = transform.origin_x;
+    header.origin_y = transform.origin_y;
+    header.step = transform.step;
+    cell_meshes.append((unsigned char *)&header, sizeof(header));
+
+    const cell_mesh_entry empty_entry = {};
+    for (uint64_t i = 0; i < header.entries_capacity; i++)
+        cell_meshes.append((const unsigned char *)&empty_entry, sizeof(empty_entry));
+}
 
-            positions_buffer.insert((POSITIONS_TYPE)poly->point_array[2].x);
-            positions_buffer.insert((POSITIONS_TYPE)poly->point_array[2].y);
-            positions_buffer.insert((POSITIONS_TYPE)zmax);
+void addCellLayerMeshes(GrowBuffer<unsigned char> &cell_meshes, uint32_t layer_idx, bool opt_just_lines, uint64_t polygons_count, const triangulation_stats &stats, GrowBuffer<POSITIONS_TYPE> &positions_buffer, GrowBuffer<INDICES_TYPE> &indices_buffer)
+{
+    const Tag tag = g_layer_stack[layer_idx].tag;
 
-            positions_buffer.insert((POSITIONS_TYPE)poly->point_array[3].x);
-            positions_buffer.insert((POSITIONS_TYPE)poly->point_array[3].y);
-            positions_buffer.insert((POSITIONS_TYPE)zmax);
+    if (g_process_options.log_cells)
+    {
+        JS_gds_info_log("\t\tLayer: %d/%d\n", gdstk::get_layer(tag), gdstk::get_type(tag));
+        JS_gds_info_log("\t\t\tpolygons: %" PRIu64 "\n", polygons_count);
+        if (!opt_just_lines)
+            JS_gds_info_log("\t\t\tvertices: %" PRIu64 " triangles: %" PRIu64 "\n", stats.total_vertices, stats.total_triangles);
+    }
 
-            indices_buffer.insert((INDICES_TYPE)0 + indices_offset);
-            indices_buffer.insert((INDICES_TYPE)1 + indices_offset);
-            indices_buffer.insert((INDICES_TYPE)2 + indices_offset);
+    if (!opt_just_lines)
+    {
+        traceCount(TRACE_COUNTER_TRIANGLES, stats.total_triangles);
 
-            indices_buffer.insert((INDICES_TYPE)0 + indices_offset);
-            indices_buffer.insert((INDICES_TYPE)2 + indices_offset);
-            indices_buffer.insert((INDICES_TYPE)3 + indices_offset);
+        g_triangulation_stats.total_vertices += stats.total_vertices;
+        g_triangulation_stats.total_triangles += stats.total_triangles;
+        g_triangulation_stats.culled_triangles += stats.culled_triangles;
+        g_triangulation_stats.shape_cache_hits += stats.shape_cache_hits;
+        g_triangulation_stats.shape_cache_misses += stats.shape_cache_misses;
+    }
 
-            indices_offset += total_poly_vertices;
+    addCellMesh(cell_meshes, layer_idx, 0, 0, positions_buffer, indices_buffer);
+}
 
-            // // SIDES
+// Packs one mesh of the layer (full detail or a coarse level) in the cell meshes blob
+void addCellMesh(GrowBuffer<unsigned char> &cell_meshes, uint32_t layer_idx, uint32_t lod_level, float lod_max_screen_size, GrowBuffer<POSITIONS_TYPE> &positions_buffer, GrowBuffer<INDICES_TYPE> &indices_buffer)
+{
+    trace_scope scope(TRACE_PACKING);
+    const Tag tag = g_layer_stack[layer_idx].tag;
+    const bool quantized = ((cell_meshes_header *)cell_meshes.data)->flags & CELL_MESHES_FLAG_QUANTIZED;
+
+    cell_mesh_entry entry = {};
+    entry.layer_number = gdstk::get_layer(tag);
+    entry.layer_datatype = gdstk::get_type(tag);
+    entry.layer_idx = layer_idx;
+    entry.z_levels[0] = g_layer_stack[layer_idx].zmin;
+    entry.z_levels[1] = g_layer_stack[layer_idx].zmax;
+    entry.lod_level = lod_level;
+    entry.lod_max_screen_size = lod_max_screen_size;
+    entry.positions_offset = cell_meshes.size();
+    entry.positions_count = positions_buffer.size();
+
+    const uint64_t positions_count = positions_buffer.size();
+    const uint64_t indices_count = indices_buffer.size();
+    const POSITIONS_TYPE *positions = (const POSITIONS_TYPE *)positions_buffer.data;
+    const INDICES_TYPE *indices = (const INDICES_TYPE *)indices_buffer.data;
+
+    // The quantized positions are already int32 (positions_transform), only their storage type is chosen here
+    entry.positions_format = CELL_MESH_POSITIONS_FLOAT32;
+    if (quantized)
+    {
+        bool fits_int16 = true;
+        for (uint64_t i = 0; i < positions_count && fits_int16; i++)
+        {
+            int32_t value;
+            memcpy(&value, positions + i, sizeof(value));
+            fits_int16 = value >= INT16_MIN && value <= INT16_MAX;
+        }
+        entry.positions_format = fits_int16 ? CELL_MESH_POSITIONS_INT16 : CELL_MESH_POSITIONS_INT32;
+    }
 
-            for (int i = 0; i < total_poly_vertices; i++)
-            {
-                indices_buffer.insert(i % total_poly_vertices + top_indices_offset);
-                indices_buffer.insert((i + 1) % total_poly_vertices + bottom_indices_offset);
-                indices_buffer.insert(i % total_poly_vertices + bottom_indices_offset);
+    // 16 bits indices when all the vertices can be addressed with them (0xffff is kept for the primitive restart index)
+    const uint64_t vertices_count = positions_count / 3;
+    entry.index_size = vertices_count < 0xffff ? sizeof(uint16_t) : sizeof(INDICES_TYPE);
 
-                indices_buffer.insert(i % total_poly_vertices + top_indices_offset);
-                indices_buffer.insert((i + 1) % total_poly_vertices + top_indices_offset);
-                indices_buffer.insert((i + 1) % total_poly_vertices + bottom_indices_offset);
-            }
+    // Both arrays are padded to keep the next one 4 bytes aligned
+    uint64_t position_size = sizeof(POSITIONS_TYPE);
+    if (entry.positions_format == CELL_MESH_POSITIONS_INT16)
+        position_size = sizeof(int16_t);
+    else if (entry.positions_format == CELL_MESH_POSITIONS_INT32)
+        position_size = sizeof(int32_t);
+    const uint64_t positions_size = (positions_count * position_size + 3) & ~(uint64_t)3;
+    const uint64_t indices_size = (indices_count * entry.index_size + 3) & ~(uint64_t)3;
+
+    unsigned char *mesh_data = cell_meshes.appendUninitialized(positions_size + indices_size);
+    entry.indices_offset = entry.positions_offset + positions_size;
+    entry.indices_count = indices_count;
 
-            total_vertices += 8;
-            total_triangles += 12;
+    if (entry.positions_format == CELL_MESH_POSITIONS_INT16)
+    {
+        int16_t *values = (int16_t *)mesh_data;
+        for (uint64_t i = 0; i < positions_count; i++)
+        {
+            int32_t value;
+            memcpy(&value, positions + i, sizeof(value));
+            values[i] = (int16_t)value;
         }
-        else
+        if (positions_count % 2 != 0)
+            values[positions_count] = 0;
+    }
+    else
+    {
+        // float32, or int32 written as they are
+        memcpy(mesh_data, positions, positions_count * sizeof(POSITIONS_TYPE));
+    }
+
+    if (entry.index_size == sizeof(uint16_t))
+    {
+        uint16_t *values = (uint16_t *)(mesh_data + positions_size);
+        for (uint64_t i = 0; i < indices_count; i++)
+            values[i] = indices[i] == RESTART_INDEX_VALUE ? 0xffff : (uint16_t)indices[i];
+        if (indices_count % 2 != 0)
+            values[indices_count] = 0;
+    }
+    else
+    {
+        memcpy(mesh_data + positions_size, indices, indices_count * sizeof(INDICES_TYPE));
+    }
+
+    // Header pointers are taken after appending, the data might have moved
+    cell_meshes_header *header = (cell_meshes_header *)cell_meshes.data;
+    cell_mesh_entry *entries = (cell_mesh_entry *)(cell_meshes.data + sizeof(cell_meshes_header));
+    entries[header->meshes_count++] = entry;
+}
+
+// Extrudes boxes of the layer and packs them in the cell meshes blob as one mesh
+void addCellLayerBoxes(GrowBuffer<unsigned char> &cell_meshes, uint32_t layer_idx, const positions_transform &transform, const std::vector<lod_box> &boxes, uint32_t lod_level, float lod_max_screen_size)
+{
+    thread_local rectangles_batch rectangles;
+    thread_local GrowBuffer<POSITIONS_TYPE> positions_buffer(64 * 1024);
+    thread_local GrowBuffer<INDICES_TYPE> indices_buffer(64 * 1024);
+
+    const POSITIONS_TYPE zmin = transform.z(g_layer_stack[layer_idx].zmin, 0);
+    const POSITIONS_TYPE zmax = transform.z(g_layer_stack[layer_idx].zmax, 1);
+
+    {
+        trace_scope scope(TRACE_LODS);
+        rectangles.clear();
+        for (const lod_box &box : boxes)
+        {
+            const float corners_x[4] = {transform.x(box.min.x), transform.x(box.max.x), transform.x(box.max.x), transform.x(box.min.x)};
+            const float corners_y[4] = {transform.y(box.min.y), transform.y(box.min.y), transform.y(box.max.y), transform.y(box.max.y)};
+            rectangles.add(corners_x, corners_y);
+        }
+
+        positions_buffer.reset();
+        indices_buffer.reset();
+        POSITIONS_TYPE *positions = positions_buffer.appendUninitialized(rectangles.size() * RECTANGLE_VERTICES * 3);
+        INDICES_TYPE *indices = indices_buffer.appendUninitialized(rectangles.size() * RECTANGLE_INDICES);
+        extrudeRectangles(rectangles, zmin, zmax, 0, positions, indices);
+    }
+
+    addCellMesh(cell_meshes, layer_idx, lod_level, lod_max_screen_size, positions_buffer, indices_buffer);
+}
+
+// Packs the coarse levels of detail of the layer in the cell meshes blob
+void addCellLayerLods(GrowBuffer<unsigned char> &cell_meshes, uint32_t layer_idx, const positions_transform &transform, const layer_lods &lods)
+{
+    for (uint32_t i = 0; i < lods.count; i++)
+    {
+        const uint32_t level = lods.levels[i];
+        addCellLayerBoxes(cell_meshes, layer_idx, transform, lods.boxes[i], level, LOD_MAX_SCREEN_SIZE[level - 1]);
+    }
+}
+
+void emitCellMeshes(Cell *cell, GrowBuffer<unsigned char> &cell_meshes)
+{
+    if (((cell_meshes_header *)cell_meshes.data)->meshes_count == 0)
+        return;
+
+    trace_scope scope(TRACE_TRANSFER);
+    JS_gds_add_cell_meshes(cell->name, cell_meshes);
+    traceCount(TRACE_COUNTER_TRANSFERS, 1);
+    traceCount(TRACE_COUNTER_TRANSFERRED_BYTES, cell_meshes.size());
+}
+
+// String table of the labels and references blobs (see cell_labels_header and references_header): every string is stored once
+struct strings_table
+{
+    std::unordered_map<std::string, uint32_t> indexes;
+    std::vector<uint32_t> offsets = {0};
+    std::string data;
+
+    void clear()
+    {
+        indexes.clear();
+        offsets.assign(1, 0);
+        data.clear();
+    }
+
+    uint32_t intern(const char *text)
+    {
+        auto inserted = indexes.emplace(text, (uint32_t)indexes.size());
+        if (inserted.second)
+        {
+            data += text;
+            offsets.push_back((uint32_t)data.size());
+        }
+        return inserted.first->second;
+    }
+};
+
+// Layer stack entry the labels of each tag are placed on: the one with the same tag, or else the first one with the
+// same layer number (SKY130 li1.label 67/5 goes over li1 67/20). Built by processCells
+static std::unordered_map<Tag, uint32_t> g_label_tag_layers;
+static std::unordered_map<uint32_t, uint32_t> g_label_number_layers;
+// Labels are drawn this much over the top of their layer
+static constexpr double LABEL_Z_OFFSET = 0.03;
+
+void buildLabelLayers()
+{
+    g_label_tag_layers.clear();
+    g_label_number_layers.clear();
+    for (uint32_t i = 0; i < g_layer_stack.count; i++)
+    {
+        g_label_tag_layers.emplace(g_layer_stack[i].tag, i);
+        g_label_number_layers.emplace(get_layer(g_layer_stack[i].tag), i);
+    }
+}
+
+// Index in g_layer_stack of the labels of tag, or UINT32_MAX if they aren't shown
+uint32_t labelLayer(Tag tag)
+{
+    auto same_tag = g_label_tag_layers.find(tag);
+    if (same_tag != g_label_tag_layers.end())
+        return same_tag->second;
+    auto same_number = g_label_number_layers.find(get_layer(tag));
+    return same_number != g_label_number_layers.end() ? same_number->second : UINT32_MAX;
+}
+
+// Packs the labels of the cell in cell_labels (see cell_labels_header). Returns false if the cell has no labels shown
+bool packCellLabels(Cell *cell, GrowBuffer<unsigned char> &cell_labels)
+{
+    trace_scope scope(TRACE_PACKING);
+
+    // Labels shown, repetitions included, to size the blob
+    uint64_t labels_count = 0;
+    for (uint64_t i = 0; i < cell->label_array.count; i++)
+    {
+        const Label *label = cell->label_array[i];
+        if (labelLayer(label->tag) != UINT32_MAX)
+            labels_count += label->repetition.type == RepetitionType::None ? 1 : label->repetition.get_count();
+    }
+    if (labels_count == 0)
+        return false;
+
+    static strings_table strings;
+    strings.clear();
+
+    cell_labels.reset();
+    cell_labels.reserve(sizeof(cell_labels_header) + labels_count * (3 * sizeof(float) + 2 * sizeof(uint32_t)));
+    cell_labels_header header = {};
+    header.labels_count = (uint32_t)labels_count;
+    cell_labels.append((const unsigned char *)&header, sizeof(header));
+    // Covered by the reserve, the arrays don't move while they're written
+    float *positions = (float *)cell_labels.appendUninitialized(labels_count * 3 * sizeof(float));
+    uint32_t *layers = (uint32_t *)cell_labels.appendUninitialized(labels_count * sizeof(uint32_t));
+    uint32_t *texts = (uint32_t *)cell_labels.appendUninitialized(labels_count * sizeof(uint32_t));
+
+    Array<Vec2> offsets = {};
+    uint64_t written = 0;
+    auto addLabel = [&](const Label *label, uint32_t layer_idx, uint32_t text, double x, double y)
+    {
+        positions[written * 3] = (float)x;
+        positions[written * 3 + 1] = (float)y;
+        positions[written * 3 + 2] = (float)(g_layer_stack[layer_idx].zmax + LABEL_Z_OFFSET);
+        layers[written] = get_layer(label->tag) | (get_type(label->tag) << 16);
+        texts[written] = text;
+        written++;
+    };
+
+    // Labels of the cell itself, read in place (repetitions are emitted at each offset)
+    for (uint64_t i = 0; i < cell->label_array.count; i++)
+    {
+        const Label *label = cell->label_array[i];
+        const uint32_t layer_idx = labelLayer(label->tag);
+        if (layer_idx == UINT32_MAX)
+            continue;
+
+        const uint32_t text = strings.intern(label->text);
+        if (label->repetition.type == RepetitionType::None)
+        {
+            addLabel(label, layer_idx, text, label->origin.x, label->origin.y);
+            continue;
+        }
+
+        offsets.count = 0;
+        label->repetition.get_offsets(offsets);
+        for (uint64_t j = 0; j < offsets.count; j++)
+            addLabel(label, layer_idx, text, label->origin.x + offsets[j].x, label->origin.y + offsets[j].y);
+    }
+    offsets.clear();
+
+    cell_labels.append((const unsigned char *)strings.offsets.data(), strings.offsets.size() * sizeof(uint32_t));
+    cell_labels.append((const unsigned char *)strings.data.data(), strings.data.size());
+
+    cell_labels_header *final_header = (cell_labels_header *)cell_labels.data;
+    final_header->strings_count = (uint32_t)strings.indexes.size();
+    final_header->strings_size = (uint32_t)strings.data.size();
+    return true;
+}
+
+void emitCellLabels(Cell *cell, GrowBuffer<unsigned char> &cell_labels)
+{
+    if (!packCellLabels(cell, cell_labels))
+        return;
+
+    trace_scope scope(TRACE_TRANSFER);
+    JS_gds_add_cell_labels(cell->name, cell_labels);
+    traceCount(TRACE_COUNTER_TRANSFERS, 1);
+    traceCount(TRACE_COUNTER_TRANSFERRED_BYTES, cell_labels.size());
+}
+
+// Frees the shapes and labels of an emitted cell (release_geometry option). The references stay, they place the cells
+// (processRegion) and reference the subcells
+void releaseCellGeometry(uint64_t cell_idx)
+{
+    Cell *cell = g_lib.cell_array[cell_idx];
+    for (uint64_t i = 0; i < cell->polygon_array.count; i++)
+    {
+        cell->polygon_array[i]->clear();
+        free_allocation(cell->polygon_array[i]);
+    }
+    for (uint64_t i = 0; i < cell->flexpath_array.count; i++)
+    {
+        cell->flexpath_array[i]->clear();
+        free_allocation(cell->flexpath_array[i]);
+    }
+    for (uint64_t i = 0; i < cell->robustpath_array.count; i++)
+    {
+        cell->robustpath_array[i]->clear();
+        free_allocation(cell->robustpath_array[i]);
+    }
+    for (uint64_t i = 0; i < cell->label_array.count; i++)
+    {
+        cell->label_array[i]->clear();
+        free_allocation(cell->label_array[i]);
+    }
+    cell->polygon_array.clear();
+    cell->flexpath_array.clear();
+    cell->robustpath_array.clear();
+    cell->label_array.clear();
+    g_cells_released[cell_idx] = true;
+}
+
+// Progress after emitting the cells_done first cells of the cells_count processed by this call
+void emitCellProgress(uint64_t cells_done, uint64_t cells_count)
+{
+    float perc = cells_done / (float)(cells_count);
+    perc = perc * 95 + 5;
+    JS_gds_process_progress(perc);
+}
+
+// Builds and emits the meshes and labels of cells (indexes of g_lib.cell_array), in that order
+void processCellsSerial(bool opt_just_lines, const std::vector<uint64_t> &cells)
+{
+    GrowBuffer<POSITIONS_TYPE> positions_buffer(1024 * 1024);
+    GrowBuffer<INDICES_TYPE> indices_buffer(1024 * 1024);
+    // Buffers grow to the largest cell, release_geometry starts them small
+    GrowBuffer<unsigned char> cell_meshes(g_process_options.release_geometry ? 64 * 1024 : 1024 * 1024);
+    GrowBuffer<unsigned char> cell_labels(64 * 1024);
+
+    layer_polygons polygons;
+    layer_merge merge;
+    layer_lods lods;
+    cell_shapes_index index;
+    layer_lods *layer_lods_ptr = g_process_options.lod_levels > 0 && !opt_just_lines ? &lods : NULL;
+
+    for (uint64_t c = 0; c < cells.size(); c++)
+    {
+        const uint64_t i = cells[c];
+        auto cell = g_lib.cell_array[i];
+        if (g_process_options.log_cells)
         {
+            JS_gds_info_log("Cell: %s\n", cell->name);
+            JS_gds_info_log("\trefs: %" PRIu64 "\n", cell->reference_array.count);
+        }
 
-            std::vector<CDT::V2d<double>> vertices;
-            CDT::EdgeVec edges;
+        const positions_transform transform = cellPositionsTransform(i);
+        beginCellMeshes(cell_meshes, opt_just_lines, transform);
+
+        buildCellShapesIndex(cell, index);
+
+        // LOOP LAYERS IN CELL
+        int layers_count = g_layer_stack.count;
+        for (int layer_idx = 0; layer_idx < layers_count; layer_idx++)
+        {
+            if (index.count(g_layer_slots[layer_idx]) == 0)
+                continue;
 
-            for (uint64_t k = 0; k < poly->point_array.count; k++)
+            triangulation_stats stats = {};
+            uint64_t polygons_count = buildCellLayer(i, index, layer_idx, opt_just_lines, transform, polygons, merge, layer_lods_ptr, positions_buffer, indices_buffer, stats);
+            if (polygons_count > 0)
             {
-                auto point = poly->point_array[k];
-                vertices.push_back({point.x, point.y});
+                addCellLayerMeshes(cell_meshes, layer_idx, opt_just_lines, polygons_count, stats, positions_buffer, indices_buffer);
+                if (layer_lods_ptr != NULL)
+                    addCellLayerLods(cell_meshes, layer_idx, transform, lods);
             }
+        }
+
+        emitCellMeshes(cell, cell_meshes);
+
+        // TEST:
+        // {
+        //     JS_gds_info_log("\t\tTEST Negative Meshes\n");
+        //     Array<Polygon *> substrate_polys = {};
+        //     Array<Polygon *> result_polys = {};
+        //     Vec2 min;
+        //     Vec2 max;
+        //     char mesh_name[1024];
+        //     float zmin;
+        //     float zmax;
+        //     int new_tag_layer = 0;
+        //     int new_tag_datatype = 0;                
+        //     cell->bounding_box(min, max);            
+        //     Polygon p = {};
+        //     p.point_array.append({min.x, min.y});
+        //     p.point_array.append({min.x, max.y});
+        //     p.point_array.append({max.x, max.y});
+        //     p.point_array.append({max.x, min.y});
+        //     substrate_polys.append(&p);
+
+        //     result_polys.clear();
+        //     const Tag poly_tag = make_tag(66, 20);                
+        //     Array<Polygon *> poly_polys = {};                
+        //     cell->get_polygons(true, true, depth, true, poly_tag, poly_polys);
+        //     boolean(substrate_polys, poly_polys, Operation::Not, 1000, result_polys);
+        //     buildMeshName(mesh_name, cell->name, "substrate-poly");
+        //     // Triangles
+        //     zmin = 0.0;
+        //     zmax = 0.18;
+        //     triangulate(result_polys, positions_buffer, indices_buffer, zmin, zmax);
+        //     JS_gds_add_mesh(cell->name, mesh_name, new_tag_layer, new_tag_datatype, positions_buffer, indices_buffer);
+
+        //     result_polys.clear();
+        //     const Tag licon_tag = make_tag(66, 44);                
+        //     Array<Polygon *> licon_polys = {};                
+        //     cell->get_polygons(true, true, depth, true, licon_tag, licon_polys);
+        //     boolean(substrate_polys, licon_polys, Operation::Not, 1000, result_polys);                
+        //     buildMeshName(mesh_name, cell->name, "substrate-licon");
+        //     // Triangles
+        //     zmin = 0.0;
+        //     zmax = 0.936;
+        //     triangulate(result_polys, positions_buffer, indices_buffer, zmin, zmax);
+        //     JS_gds_add_mesh(cell->name, mesh_name, new_tag_layer, new_tag_datatype, positions_buffer, indices_buffer);
+
+        //     result_polys.clear();
+        //     const Tag li1_tag = make_tag(67, 20);                
+        //     Array<Polygon *> li1_polys = {};                
+        //     cell->get_polygons(true, true, depth, true, li1_tag, li1_polys);
+        //     boolean(substrate_polys, li1_polys, Operation::Not, 1000, result_polys);                
+        //     buildMeshName(mesh_name, cell->name, "substrate-li1");
+        //     // Triangles
+        //     zmin = 0.936;
+        //     zmax = 1.136;
+        //     triangulate(result_polys, positions_buffer, indices_buffer, zmin, zmax);
+        //     JS_gds_add_mesh(cell->name, mesh_name, new_tag_layer, new_tag_datatype, positions_buffer, indices_buffer);
+
+        //     result_polys.clear();
+        //     const Tag mcon_tag = make_tag(67, 44);                
+        //     Array<Polygon *> mcon_polys = {};                
+        //     cell->get_polygons(true, true, depth, true, mcon_tag, mcon_polys);
+        //     boolean(substrate_polys, mcon_polys, Operation::Not, 1000, result_polys);                
+        //     buildMeshName(mesh_name, cell->name, "substrate-mcon");
+        //     // Triangles
+        //     zmin = 1.011;
+        //     zmax = 1.376;
+        //     triangulate(result_polys, positions_buffer, indices_buffer, zmin, zmax);
+        //     JS_gds_add_mesh(cell->name, mesh_name, new_tag_layer, new_tag_datatype, positions_buffer, indices_buffer);               
+
+        // }
+
+        // LABELS
+        emitCellLabels(cell, cell_labels);
+        if (g_process_options.release_geometry)
+            releaseCellGeometry(i);
+
+        emitCellProgress(c + 1, cells.size());
+    }
+
+    polygons.free();
+    index.free();
+}
+
+// Same output as processCellsSerial, but the (cell, layer) pairs are built by a pool of workers.
+// Cells are handled in batches: their shapes indexes are built in parallel, then the non-empty (cell, layer) jobs,
+// and the results are emitted in the serial order
+void processCellsParallel(bool opt_just_lines, const std::vector<uint64_t> &cells, uint32_t threads_count)
+{
+    struct worker_data
+    {
+        layer_polygons polygons;
+        layer_merge merge;
+    };
+
+    // Meshes of a job, built in place and emitted from there
+    // Results are kept between batches (the job j of each batch reuses results[j]), so their buffers don't have to be allocated again
+    struct job_result
+    {
+        GrowBuffer<POSITIONS_TYPE> positions_buffer{64 * 1024};
+        GrowBuffer<INDICES_TYPE> indices_buffer{64 * 1024};
+    };
+
+    struct cell_layer_job
+    {
+        uint64_t cell_idx = 0;
+        // Position of the cell in the batch (its indexes entry)
+        uint64_t batch_idx = 0;
+        uint32_t layer_idx = 0;
+        // With merge_layers, the job keeps its polygons between the gather, tiles and build passes
+        layer_polygons *polygons = NULL;
+        layer_merge *merge = NULL;
+        uint64_t polygons_count = 0;
+        triangulation_stats stats = {};
+        layer_lods lods;
+    };
+
+    // Limits how many results wait to be emitted
+    constexpr uint64_t batch_jobs = 4096;
+
+    const uint64_t layers_count = g_layer_stack.count;
+    const uint64_t batch_cells = layers_count > 0 && layers_count < batch_jobs ? batch_jobs / layers_count : 1;
+
+    std::vector<worker_data> workers(threads_count);
+    std::vector<cell_shapes_index> indexes(batch_cells);
+    std::vector<cell_layer_job> jobs;
+    std::vector<std::unique_ptr<job_result>> results;
+    // Jobs of the batch cell c are jobs[cell_jobs_begin[c] .. cell_jobs_begin[c + 1])
+    std::vector<uint64_t> cell_jobs_begin;
+    // (job, tile) pairs of the merge_layers pass
+    std::vector<std::pair<uint64_t, uint32_t>> merge_tiles;
+    // Buffers grow to the largest cell, release_geometry starts them small
+    GrowBuffer<unsigned char> cell_meshes(g_process_options.release_geometry ? 64 * 1024 : 1024 * 1024);
+    GrowBuffer<unsigned char> cell_labels(64 * 1024);
+
+    // cell_begin and cell_end are positions in cells, job.cell_idx is the g_lib.cell_array index
+    for (uint64_t cell_begin = 0; cell_begin < cells.size(); cell_begin += batch_cells)
+    {
+        const uint64_t cell_end = std::min(cell_begin + batch_cells, (uint64_t)cells.size());
 
-            for (uint64_t k = 0; k < poly->point_array.count - 1; k++)
+        runJobs(cell_end - cell_begin, threads_count, [&](uint32_t worker_idx, uint64_t job_idx)
+                { buildCellShapesIndex(g_lib.cell_array[cells[cell_begin + job_idx]], indexes[job_idx]); });
+
+        jobs.clear();
+        cell_jobs_begin.clear();
+        for (uint64_t i = cell_begin; i < cell_end; i++)
+        {
+            cell_jobs_begin.push_back(jobs.size());
+            for (uint32_t layer_idx = 0; layer_idx < layers_count; layer_idx++)
             {
-                edges.push_back({(CDT::VertInd)k, (CDT::VertInd)k + 1});
+                if (indexes[i - cell_begin].count(g_layer_slots[layer_idx]) == 0)
+                    continue;
+
+                cell_layer_job job;
+                job.cell_idx = cells[i];
+                job.batch_idx = i - cell_begin;
+                job.layer_idx = layer_idx;
+                jobs.push_back(job);
             }
-            // close polygon:
-            edges.push_back({(CDT::VertInd)poly->point_array.count - 1, (CDT::VertInd)0});
+        }
+        cell_jobs_begin.push_back(jobs.size());
+        while (results.size() < jobs.size())
+            results.emplace_back(new job_result());
 
-            CDT::Triangulation<double> cdt(
-                CDT::detail::defaults::vertexInsertionOrder,
-                // CDT::IntersectingConstraintEdges::TryResolve,
-                CDT::IntersectingConstraintEdges::NotAllowed,
-                CDT::detail::defaults::minDistToConstraintEdge);
+        if (g_process_options.merge_layers)
+        {
+            // Layers are split in tiles, and the tiles of all the batch jobs are merged in parallel
+            runJobs(jobs.size(), threads_count, [&](uint32_t worker_idx, uint64_t job_idx)
+                    {
+                        cell_layer_job &job = jobs[job_idx];
+                        job.polygons = new layer_polygons();
+                        job.merge = new layer_merge();
+                        getCellLayerPolygons(indexes[job.batch_idx], g_layer_slots[job.layer_idx], *job.polygons);
+                        job.merge->prepare(job.polygons->polygons, mergeScaling()); });
+
+            merge_tiles.clear();
+            for (uint64_t j = 0; j < jobs.size(); j++)
+                for (uint32_t tile_idx = 0; tile_idx < jobs[j].merge->tilesCount(); tile_idx++)
+                    merge_tiles.push_back({j, tile_idx});
+
+            runJobs(merge_tiles.size(), threads_count, [&](uint32_t worker_idx, uint64_t job_idx)
+                    { jobs[merge_tiles[job_idx].first].merge->mergeTile(merge_tiles[job_idx].second); });
+        }
 
-            CDT::DuplicatesInfo dup_info;
+        runJobs(jobs.size(), threads_count, [&](uint32_t worker_idx, uint64_t job_idx)
+                {
+                    cell_layer_job &job = jobs[job_idx];
+                    worker_data &worker = workers[worker_idx];
+                    job_result &result = *results[job_idx];
+                    const positions_transform transform = cellPositionsTransform(job.cell_idx);
+                    layer_lods *lods = g_process_options.lod_levels > 0 && !opt_just_lines ? &job.lods : NULL;
 
-            dup_info = CDT::RemoveDuplicatesAndRemapEdges(vertices, edges);
-            cdt.insertVertices(vertices);
-            cdt.insertEdges(edges);
-            cdt.eraseOuterTrianglesAndHoles();
+                    if (job.merge != NULL)
+                    {
+                        finishLayerMerge(*job.merge, *job.polygons);
+                        job.polygons_count = buildLayerMeshes(job.cell_idx, *job.polygons, job.layer_idx, opt_just_lines, transform, lods, result.positions_buffer, result.indices_buffer, job.stats);
+                        job.polygons->free();
+                        delete job.polygons;
+                        delete job.merge;
+                    }
+                    else
+                    {
+                        job.polygons_count = buildCellLayer(job.cell_idx, indexes[job.batch_idx], job.layer_idx, opt_just_lines, transform, worker.polygons, worker.merge, lods, result.positions_buffer, result.indices_buffer, job.stats);
+                    } });
 
-            total_triangles += cdt.triangles.size();
-            total_vertices += cdt.vertices.size();
+        for (uint64_t c = cell_begin; c < cell_end; c++)
+        {
+            const uint64_t i = cells[c];
+            auto cell = g_lib.cell_array[i];
+            if (g_process_options.log_cells)
+            {
+                JS_gds_info_log("Cell: %s\n", cell->name);
+                JS_gds_info_log("\trefs: %" PRIu64 "\n", cell->reference_array.count);
+            }
 
-            // EXTRUSION
+            const positions_transform transform = cellPositionsTransform(i);
+            beginCellMeshes(cell_meshes, opt_just_lines, transform);
 
-            int total_poly_vertices = cdt.vertices.size();
-            // BOTTOM FACES
-            int bottom_indices_offset = indices_offset;
-            for (int i = 0; i < total_poly_vertices; i++)
+            for (uint64_t j = cell_jobs_begin[c - cell_begin]; j < cell_jobs_begin[c - cell_begin + 1]; j++)
             {
-                positions_buffer.insert((POSITIONS_TYPE)cdt.vertices[i].x);
-                positions_buffer.insert((POSITIONS_TYPE)cdt.vertices[i].y);
-                positions_buffer.insert((POSITIONS_TYPE)zmin);
+                cell_layer_job &job = jobs[j];
+                if (job.polygons_count > 0)
+                {
+                    addCellLayerMeshes(cell_meshes, job.layer_idx, opt_just_lines, job.polygons_count, job.stats, results[j]->positions_buffer, results[j]->indices_buffer);
+                    addCellLayerLods(cell_meshes, job.layer_idx, transform, job.lods);
+                }
             }
-            int orientation = 0;
-            for (int i = 0; i < cdt.triangles.size(); i++)
+
+            emitCellMeshes(cell, cell_meshes);
+
+            emitCellLabels(cell, cell_labels);
+            if (g_process_options.release_geometry)
+                releaseCellGeometry(i);
+
+            emitCellProgress(c + 1, cells.size());
+        }
+    }
+
+    for (auto &worker : workers)
+        worker.polygons.free();
+    for (auto &index : indexes)
+        index.free();
+}
+
+// Emits the cells as aliases of the cell built for their group (alias_identical_cells), with their own labels
+void emitCellAliases(const std::vector<uint64_t> &cells)
+{
+    GrowBuffer<unsigned char> cell_labels(64 * 1024);
+    for (uint64_t cell_idx : cells)
+    {
+        Cell *cell = g_lib.cell_array[cell_idx];
+        const uint64_t source_idx = g_cell_aliases.groups_source[g_cell_aliases.cells_group[cell_idx]];
+        const Vec2 &origin = g_cell_aliases.origins[cell_idx];
+        const Vec2 &source_origin = g_cell_aliases.origins[source_idx];
+        {
+            trace_scope scope(TRACE_TRANSFER);
+            JS_gds_add_cell_alias(cell->name, g_lib.cell_array[source_idx]->name, origin.x - source_origin.x, origin.y - source_origin.y);
+            traceCount(TRACE_COUNTER_TRANSFERS, 1);
+        }
+
+        emitCellLabels(cell, cell_labels);
+        if (g_process_options.release_geometry)
+            releaseCellGeometry(cell_idx);
+    }
+}
+
+// Processes the cells (indexes of g_lib.cell_array) with the serial or parallel pipeline and marks them as emitted
+// With alias_identical_cells, the copies of a cell built before (or earlier in cells) are emitted as aliases after them
+void processCellsList(bool opt_just_lines, const std::vector<uint64_t> &cells)
+{
+    buildLayerTagSlots();
+    buildLabelLayers();
+
+    std::vector<uint64_t> built_cells;
+    std::vector<uint64_t> alias_cells;
+    if (g_process_options.alias_identical_cells)
+    {
+        if (!g_cell_aliases_built)
+        {
+            trace_scope scope(TRACE_ALIASES);
+            g_cell_aliases.build(g_lib.cell_array, 1 / mergeScaling());
+            g_cell_aliases_built = true;
+            JS_gds_info_log("Cell aliases: %" PRIu64 " groups of identical cells, %" PRIu64 " cells emitted as aliases\n", (uint64_t)g_cell_aliases.groups_source.size(), g_cell_aliases.aliasesCount());
+        }
+
+        for (uint64_t cell_idx : cells)
+        {
+            const uint32_t group = g_cell_aliases.cells_group[cell_idx];
+            if (group != cell_aliases::NO_GROUP && g_cell_aliases.groups_source[group] != cell_aliases::NO_CELL)
             {
-                int d0 = cdt.triangles[i].vertices[0] - cdt.triangles[i].vertices[1];
-                int d1 = cdt.triangles[i].vertices[1] - cdt.triangles[i].vertices[2];
-                int d2 = cdt.triangles[i].vertices[2] - cdt.triangles[i].vertices[0];
-                if (d0 == 1 || d1 == 1 || d2 == 1)
-                    orientation = 1;
-                else if (d0 == -1 || d1 == -1 || d2 == -1)
-                    orientation = -1;
-
-                indices_buffer.insert((INDICES_TYPE)cdt.triangles[i].vertices[2] + indices_offset);
-                indices_buffer.insert((INDICES_TYPE)cdt.triangles[i].vertices[1] + indices_offset);
-                indices_buffer.insert((INDICES_TYPE)cdt.triangles[i].vertices[0] + indices_offset);
+                alias_cells.push_back(cell_idx);
+                continue;
             }
-            indices_offset += total_poly_vertices;
+            if (group != cell_aliases::NO_GROUP)
+                g_cell_aliases.groups_source[group] = cell_idx;
+            built_cells.push_back(cell_idx);
+        }
+    }
+    const std::vector<uint64_t> &process_cells = g_process_options.alias_identical_cells ? built_cells : cells;
+
+    uint32_t threads_count = std::min(g_process_options.threads, maxJobThreads());
+    if (threads_count > 1)
+    {
+        JS_gds_info_log("Using %u threads\n", threads_count);
+        processCellsParallel(opt_just_lines, process_cells, threads_count);
+    }
+    else
+    {
+        processCellsSerial(opt_just_lines, process_cells);
+    }
+    emitCellAliases(alias_cells);
+
+    for (uint64_t cell_idx : cells)
+        g_cells_emitted[cell_idx] = true;
+}
+
+// Placements of the top cell references, expanded by their repetitions
+void buildPlacementsIndex()
+{
+    g_placements.clear();
+    g_placements_built = true;
+    if (g_top_cell == NULL)
+        return;
+
+    Array<Vec2> offsets = {};
+    for (uint64_t i = 0; i < g_top_cell->reference_array.count; i++)
+    {
+        const Reference *reference = g_top_cell->reference_array[i];
+        if (reference->type != ReferenceType::Cell)
+            continue;
+        auto found = g_cells_idx.find(reference->cell);
+        if (found == g_cells_idx.end())
+            continue;
+
+        const uint64_t cell_idx = found->second;
+        const Vec2 &cell_min = g_cells_origin[cell_idx];
+        const Vec2 &cell_max = g_cells_max[cell_idx];
+        // Empty cells have a zero bounding box, they are still placed to emit their subcells
+        offsets.count = 0;
+        reference->repetition.get_offsets(offsets);
+        if (offsets.count == 0)
+            offsets.append(Vec2{0, 0});
+        for (uint64_t j = 0; j < offsets.count; j++)
+        {
+            Vec2 box_min, box_max;
+            referenceBoundingBox(reference, offsets[j], cell_min, cell_max, box_min, box_max);
+            g_placements.add(cell_idx, box_min, box_max);
+        }
+    }
+    offsets.clear();
+
+    g_placements.build();
+    JS_gds_info_log("Placements index: %" PRIu64 " placements, %ux%u grid\n", (uint64_t)g_placements.placements.size(), g_placements.columns, g_placements.rows);
+}
 
-            // TOP FACES
-            int top_indices_offset = indices_offset;
-            for (int i = 0; i < total_poly_vertices; i++)
+// Polygons (before repetitions) that processing the cell triangulates, used to fill the processRegion budget
+uint64_t cellShapesCount(const Cell *cell)
+{
+    return cell->polygon_array.count + cell->flexpath_array.count + cell->robustpath_array.count;
+}
+
+// Sorts the cells by visual importance (most important first): the cell area times its instances under the top cell,
+// counted through the whole hierarchy with the repetitions. Cells that aren't under the top cell go last
+void sortCellsByImportance(std::vector<uint64_t> &cells)
+{
+    const uint64_t cells_count = g_lib.cell_array.count;
+    auto childIdx = [](const Reference *reference) -> uint64_t
+    {
+        if (reference->type != ReferenceType::Cell)
+            return UINT64_MAX;
+        auto found = g_cells_idx.find(reference->cell);
+        return found != g_cells_idx.end() ? found->second : UINT64_MAX;
+    };
+
+    // Reverse postorder of a depth first search: parents before their children
+    std::vector<uint64_t> order;
+    std::vector<bool> visited(cells_count, false);
+    std::vector<std::pair<uint64_t, uint64_t>> stack;
+    for (uint64_t root = 0; root < cells_count; root++)
+    {
+        if (visited[root])
+            continue;
+        visited[root] = true;
+        stack.push_back({root, 0});
+        while (!stack.empty())
+        {
+            const uint64_t cell_idx = stack.back().first;
+            const Cell *cell = g_lib.cell_array[cell_idx];
+            if (stack.back().second < cell->reference_array.count)
             {
-                positions_buffer.insert((POSITIONS_TYPE)cdt.vertices[i].x);
-                positions_buffer.insert((POSITIONS_TYPE)cdt.vertices[i].y);
-                positions_buffer.insert((POSITIONS_TYPE)(zmax));
+                const uint64_t child_idx = childIdx(cell->reference_array[stack.back().second++]);
+                if (child_idx != UINT64_MAX && !visited[child_idx])
+                {
+                    visited[child_idx] = true;
+                    stack.push_back({child_idx, 0});
+                }
+                continue;
             }
-            for (int i = 0; i < cdt.triangles.size(); i++)
+            order.push_back(cell_idx);
+            stack.pop_back();
+        }
+    }
+    std::reverse(order.begin(), order.end());
+
+    std::vector<double> instances(cells_count, 0);
+    if (g_top_cell != NULL)
+        instances[g_cells_idx[g_top_cell]] = 1;
+    for (uint64_t cell_idx : order)
+    {
+        if (instances[cell_idx] == 0)
+            continue;
+        const Cell *cell = g_lib.cell_array[cell_idx];
+        for (uint64_t j = 0; j < cell->reference_array.count; j++)
+        {
+            const Reference *reference = cell->reference_array[j];
+            const uint64_t child_idx = childIdx(reference);
+            if (child_idx != UINT64_MAX)
+                instances[child_idx] += instances[cell_idx] * std::max<uint64_t>(reference->repetition.get_count(), 1);
+        }
+    }
+
+    std::vector<double> importance(cells_count);
+    for (uint64_t i = 0; i < cells_count; i++)
+    {
+        const Vec2 size = g_cells_max[i] - g_cells_origin[i];
+        importance[i] = instances[i] * size.x * size.y;
+    }
+    std::stable_sort(cells.begin(), cells.end(), [&](uint64_t a, uint64_t b)
+                     { return importance[a] > importance[b]; });
+}
+
+// Emits, for each cell, a mesh per layer with the bounding box of its polygons (paths are left out), flagged as
+// CELL_MESHES_FLAG_PLACEHOLDER. They take no triangulation, so the viewer can show the whole layout before the real meshes
+void emitCellPlaceholders(const std::vector<uint64_t> &cells)
+{
+    buildLayerTagSlots();
+
+    GrowBuffer<unsigned char> cell_meshes(64 * 1024);
+    cell_shapes_index index;
+    std::vector<lod_box> boxes(1);
+
+    for (uint64_t cell_idx : cells)
+    {
+        Cell *cell = g_lib.cell_array[cell_idx];
+        const positions_transform transform = cellPositionsTransform(cell_idx);
+        beginCellMeshes(cell_meshes, false, transform);
+        ((cell_meshes_header *)cell_meshes.data)->flags |= CELL_MESHES_FLAG_PLACEHOLDER;
+
+        // The placeholder boxes only use polygons
+        buildCellShapesIndex(cell, index, false);
+        for (uint32_t layer_idx = 0; layer_idx < g_layer_stack.count; layer_idx++)
+        {
+            const uint32_t slot = g_layer_slots[layer_idx];
+            bool found = false;
+            Vec2 min, max;
+            for (uint32_t i = index.slot_begin[slot]; i < index.slot_begin[slot + 1]; i++)
             {
-                indices_buffer.insert(cdt.triangles[i].vertices[0] + indices_offset);
-                indices_buffer.insert(cdt.triangles[i].vertices[1] + indices_offset);
-                indices_buffer.insert(cdt.triangles[i].vertices[2] + indices_offset);
+                const cell_shapes_index::shape &shape = index.shapes[i];
+                if (shape.type != cell_shapes_index::SHAPE_POLYGON)
+                    continue;
+
+                Vec2 poly_min, poly_max;
+                shape.polygon->bounding_box(poly_min, poly_max);
+                min = found ? Vec2{std::min(min.x, poly_min.x), std::min(min.y, poly_min.y)} : poly_min;
+                max = found ? Vec2{std::max(max.x, poly_max.x), std::max(max.y, poly_max.y)} : poly_max;
+                found = true;
             }
-            indices_offset += total_poly_vertices;
+            if (!found)
+                continue;
 
-            // ToDo: We are assuming vertices are sorted like the edges of the polygon. It seems that is the case but might be worth do some extra checking
-            // ToDo: I had some issue with SKY130, INV4, LI1 layer, that has a hole (and a duplicated vertex?). The extrusion in the last segments is not closing well.
-            // EXTRUDE
-            if (dup_info.duplicates.size() > 0)
+            boxes[0] = {min, max};
+            addCellLayerBoxes(cell_meshes, layer_idx, transform, boxes, 0, 0);
+        }
+
+        emitCellMeshes(cell, cell_meshes);
+    }
+
+    JS_gds_finished_placeholders();
+}
+
+extern "C"
+{
+    EMSCRIPTEN_KEEPALIVE
+    void processCells(bool opt_just_lines = false)
+    {
+        JS_gds_info_log("Start processing cell\n");
+
+        // Cells emitted before by processRegion are not emitted again
+        std::vector<uint64_t> cells;
+        for (uint64_t i = 0; i < g_lib.cell_array.count; i++)
+            if (!g_cells_emitted[i])
+                cells.push_back(i);
+
+        if (g_process_options.progressive_emission)
+        {
+            sortCellsByImportance(cells);
+            if (!opt_just_lines)
+                emitCellPlaceholders(cells);
+        }
+        processCellsList(opt_just_lines, cells);
+
+        JS_gds_info_log("Finished processing cell\n");
+
+        JS_gds_info_log("Triangulation stats: total_vertices: %" PRIu64 " total_triangles: %" PRIu64 " culled_triangles: %" PRIu64 "\n", g_triangulation_stats.total_vertices, g_triangulation_stats.total_triangles, g_triangulation_stats.culled_triangles);
+        if (g_process_options.shape_cache)
+            JS_gds_info_log("Shape cache: %" PRIu64 " hits, %" PRIu64 " misses\n", g_triangulation_stats.shape_cache_hits, g_triangulation_stats.shape_cache_misses);
+        if (g_process_options.triangulation_cache)
+            JS_gds_info_log("Triangulation cache: %" PRIu64 " layers, %" PRIu64 " bytes\n", g_triangulation_cache.count(), g_triangulation_cache.bytes());
+        if (g_trace_enabled)
+            tracePrintSummary(JS_gds_info_log);
+
+        const memory_stats memory = getMemoryStats();
+        JS_gds_info_log("Memory: used %.1f MB, peak %.1f MB, reserved %.1f MB\n", memory.used / (1024.0 * 1024.0), memory.peak / (1024.0 * 1024.0), memory.reserved / (1024.0 * 1024.0));
+        if (g_top_cell != NULL)
+            JS_gds_stats(g_top_cell->name, g_lib_info, memory);
+
+        JS_gds_process_progress(100);
+    }
+
+    // Writes the events recorded with the trace process option as Chrome trace events JSON (chrome://tracing, ui.perfetto.dev)
+    EMSCRIPTEN_KEEPALIVE
+    bool writeTrace(const char *filepath)
+    {
+        if (!traceWrite(filepath))
+        {
+            JS_gds_info_log("Can't write the trace to %s\n", filepath);
+            return false;
+        }
+        JS_gds_info_log("Trace written to %s\n", filepath);
+        return true;
+    }
+
+    // Lets processCells and processRegion emit all the cells again, e.g. after changing the layer stack or the output mode.
+    // With the triangulation_cache option they only extrude the cached triangulations again. Cells released by the
+    // release_geometry option stay emitted
+    EMSCRIPTEN_KEEPALIVE
+    void resetProcessedCells()
+    {
+        uint64_t released = 0;
+        for (uint64_t i = 0; i < g_cells_emitted.size(); i++)
+        {
+            g_cells_emitted[i] = g_cells_released[i];
+            released += g_cells_released[i] ? 1 : 0;
+        }
+        if (released > 0)
+            JS_gds_info_log("%" PRIu64 " cells were released (release_geometry), they can't be emitted again\n", released);
+        // Aliases of a released cell can still use its meshes
+        for (uint64_t &source_idx : g_cell_aliases.groups_source)
+            if (source_idx != cell_aliases::NO_CELL && !g_cells_released[source_idx])
+                source_idx = cell_aliases::NO_CELL;
+        g_triangulation_stats = {};
+        shape_triangulation_cache::clearAll();
+    }
+
+    // Emits the cells not emitted yet that are visible in the rectangle [min, max] of the top cell coordinates: the cells of the
+    // top cell references placed over it and all their subcells, plus the top cell itself.
+    // Cells under more placements go first, and cells are added until they hold budget shapes (at least one cell; 0: no limit).
+    // Returns how many cells of the rectangle are still left, so the caller can ask again until it gets 0
+    EMSCRIPTEN_KEEPALIVE
+    uint32_t processRegion(double min_x, double min_y, double max_x, double max_y, uint32_t budget, bool opt_just_lines = false)
+    {
+        if (g_top_cell == NULL)
+            return 0;
+
+        if (!g_placements_built)
+            buildPlacementsIndex();
+
+        std::vector<uint32_t> hits;
+        g_placements.query(Vec2{std::min(min_x, max_x), std::min(min_y, max_y)}, Vec2{std::max(min_x, max_x), std::max(min_y, max_y)}, hits);
+
+        // Placements over the rectangle of each cell, and the subcells reached from them
+        std::vector<uint64_t> placements_count(g_lib.cell_array.count, 0);
+        std::vector<bool> visited(g_lib.cell_array.count, false);
+        std::vector<uint64_t> region_cells;
+
+        std::vector<uint64_t> stack;
+        const uint64_t top_cell_idx = g_cells_idx[g_top_cell];
+        stack.push_back(top_cell_idx);
+        for (uint32_t placement_idx : hits)
+        {
+            const uint64_t cell_idx = g_placements.placements[placement_idx].cell_idx;
+            placements_count[cell_idx]++;
+            stack.push_back(cell_idx);
+        }
+        while (!stack.empty())
+        {
+            const uint64_t cell_idx = stack.back();
+            stack.pop_back();
+            if (visited[cell_idx])
+                continue;
+            visited[cell_idx] = true;
+            region_cells.push_back(cell_idx);
+
+            // The top cell subcells are only reached through the placements over the rectangle
+            if (cell_idx == top_cell_idx)
+                continue;
+            const Cell *cell = g_lib.cell_array[cell_idx];
+            for (uint64_t j = 0; j < cell->reference_array.count; j++)
             {
-                // printf("con dpublicados: %d\n", dup_info.duplicates.size());
+                const Reference *reference = cell->reference_array[j];
+                if (reference->type != ReferenceType::Cell)
+                    continue;
+                auto found = g_cells_idx.find(reference->cell);
+                if (found != g_cells_idx.end() && !visited[found->second])
+                    stack.push_back(found->second);
+            }
+        }
 
-                for (int i = 0; i < poly->point_array.count; i++)
-                {
-                    int ai0 = dup_info.mapping[i % poly->point_array.count] + bottom_indices_offset;
-                    int ai1 = dup_info.mapping[(i + 1) % poly->point_array.count] + bottom_indices_offset;
-                    int ai2 = dup_info.mapping[i % poly->point_array.count] + top_indices_offset;
+        std::vector<uint64_t> pending;
+        for (uint64_t cell_idx : region_cells)
+            if (!g_cells_emitted[cell_idx])
+                pending.push_back(cell_idx);
+        std::stable_sort(pending.begin(), pending.end(), [&](uint64_t a, uint64_t b)
+                         { return placements_count[a] > placements_count[b]; });
+
+        std::vector<uint64_t> cells;
+        uint64_t shapes = 0;
+        for (uint64_t cell_idx : pending)
+        {
+            if (budget > 0 && !cells.empty() && shapes + cellShapesCount(g_lib.cell_array[cell_idx]) > budget)
+                break;
+            shapes += cellShapesCount(g_lib.cell_array[cell_idx]);
+            cells.push_back(cell_idx);
+        }
 
-                    int bi0 = dup_info.mapping[(i + 1) % poly->point_array.count] + bottom_indices_offset;
-                    int bi1 = dup_info.mapping[(i + 1) % poly->point_array.count] + top_indices_offset;
-                    int bi2 = dup_info.mapping[i % poly->point_array.count] + top_indices_offset;
+        JS_gds_info_log("Region (%f, %f) - (%f, %f): %" PRIu64 " placements, %" PRIu64 " cells, %" PRIu64 " pending, processing %" PRIu64 " (%" PRIu64 " shapes)\n", min_x, min_y, max_x, max_y, (uint64_t)hits.size(), (uint64_t)region_cells.size(), (uint64_t)pending.size(), (uint64_t)cells.size(), shapes);
 
-                    if (orientation == -1)
-                    {
-                        indices_buffer.insert(ai0);
-                        indices_buffer.insert(ai1);
-                        indices_buffer.insert(ai2);
+        if (!cells.empty())
+            processCellsList(opt_just_lines, cells);
 
-                        indices_buffer.insert(bi0);
-                        indices_buffer.insert(bi1);
-                        indices_buffer.insert(bi2);
-                    }
-                    else
-                    {
-                        indices_buffer.insert(ai2);
-                        indices_buffer.insert(ai1);
-                        indices_buffer.insert(ai0);
+        return (uint32_t)(pending.size() - cells.size());
+    }
+}
 
-                        indices_buffer.insert(bi2);
-                        indices_buffer.insert(bi1);
-                        indices_buffer.insert(bi0);
-                    }
+// Packs the references of all the cells of lib in references (see references_header)
+void packReferences(Library &lib, GrowBuffer<unsigned char> &references)
+{
+    trace_scope scope(TRACE_REFERENCES);
+
+    strings_table strings;
+    std::vector<reference_entry> entries;
+    uint64_t instances_count = 0;
+
+    for (int i = 0; i < lib.cell_array.count; i++)
+    {
+        auto cell = lib.cell_array[i];
+        const uint32_t parent_cell_name = strings.intern(cell->name);
+
+        for (int j = 0; j < cell->reference_array.count; j++)
+        {
+            Reference *ref = cell->reference_array[j];
+
+            const char *child_instance_name;
+
+            // ToDo: 61 seems to be the property on sky130, but not in others?
+            // For now we use the first GDS property we found as the instance name
+            // properties_print(ref->properties);
+            // auto *gds_instance_name_prop = gdstk::get_gds_property(ref->properties, 61);
+            auto *gds_instance_name_prop = GDSTKUTIL_get_first_gds_property(ref->properties);
+            if (gds_instance_name_prop == NULL)
+                child_instance_name = "???";
+            else
+                child_instance_name = (char *)gds_instance_name_prop->bytes;
+
+            // ToDo: contemplate case where ReferenceType is RawCell or just name
+            // ToDo: put a name to the array instances (use col and row indexes?)
+            reference_entry entry = {};
+            entry.origin_x = ref->origin.x;
+            entry.origin_y = ref->origin.y;
+            entry.rotation = ref->rotation;
+            entry.parent_cell_name = parent_cell_name;
+            entry.cell_name = strings.intern(ref->cell->name);
+            entry.instance_name = strings.intern(child_instance_name);
+            entry.x_reflection = ref->x_reflection ? 1 : 0;
+            entry.columns = entry.rows = 1;
+
+            const Repetition &repetition = ref->repetition;
+            switch (repetition.type)
+            {
+            case RepetitionType::None:
+                entries.push_back(entry);
+                break;
+            case RepetitionType::Rectangular:
+                // Same offsets as Repetition::get_offsets: (column * spacing.x, row * spacing.y)
+                entry.columns = (uint32_t)repetition.columns;
+                entry.rows = (uint32_t)repetition.rows;
+                entry.v1_x = repetition.spacing.x;
+                entry.v2_y = repetition.spacing.y;
+                entries.push_back(entry);
+                break;
+            case RepetitionType::Regular:
+                entry.columns = (uint32_t)repetition.columns;
+                entry.rows = (uint32_t)repetition.rows;
+                entry.v1_x = repetition.v1.x;
+                entry.v1_y = repetition.v1.y;
+                entry.v2_x = repetition.v2.x;
+                entry.v2_y = repetition.v2.y;
+                entries.push_back(entry);
+                break;
+            default:
+            {
+                // Explicit offsets have no compact form, one entry each
+                Array<Vec2> offsets = {};
+                repetition.get_offsets(offsets);
+                for (uint64_t k = 0; k < offsets.count; k++)
+                {
+                    reference_entry instance = entry;
+                    instance.origin_x += offsets[k].x;
+                    instance.origin_y += offsets[k].y;
+                    entries.push_back(instance);
                 }
+                offsets.clear();
+                break;
+            }
+            }
+            instances_count += repetition.type == RepetitionType::None ? 1 : repetition.get_count();
+        }
+    }
+
+    references_header header = {};
+    header.strings_count = (uint32_t)strings.indexes.size();
+    header.strings_size = (uint32_t)strings.data.size();
+    header.references_count = (uint32_t)entries.size();
+    const uint64_t strings_begin = sizeof(header) + (header.strings_count + 1) * sizeof(uint32_t);
+    header.entries_offset = (uint32_t)((strings_begin + header.strings_size + 7) & ~(uint64_t)7);
+    const uint64_t blob_size = header.entries_offset + entries.size() * sizeof(reference_entry);
+
+    references.reset();
+    unsigned char *blob = references.appendUninitialized(blob_size);
+    memset(blob, 0, header.entries_offset);
+    memcpy(blob, &header, sizeof(header));
+    memcpy(blob + sizeof(header), strings.offsets.data(), strings.offsets.size() * sizeof(uint32_t));
+    memcpy(blob + strings_begin, strings.data.data(), strings.data.size());
+    if (!entries.empty())
+        memcpy(blob + header.entries_offset, entries.data(), entries.size() * sizeof(reference_entry));
+
+    JS_gds_info_log("References: %u entries for %" PRIu64 " instances, %u names (%" PRIu64 " bytes)\n", header.references_count, instances_count, header.strings_count, blob_size);
+}
+
+void processReferencesHierarchy(Library &lib)
+{
+    GrowBuffer<unsigned char> references(64 * 1024);
+    packReferences(lib, references);
+
+    {
+        trace_scope scope(TRACE_TRANSFER);
+        JS_gds_add_references(references);
+        traceCount(TRACE_COUNTER_TRANSFERS, 1);
+        traceCount(TRACE_COUNTER_TRANSFERRED_BYTES, references.size());
+    }
+    JS_gds_finished_references();
+}
+
+bool isRectangle(const Polygon *poly)
+{
+    return poly->point_array.count == 4 &&
+           ((poly->point_array[0].x == poly->point_array[1].x && poly->point_array[2].x == poly->point_array[3].x && poly->point_array[0].y == poly->point_array[3].y && poly->point_array[1].y == poly->point_array[2].y) ||
+            (poly->point_array[0].x == poly->point_array[3].x && poly->point_array[1].x == poly->point_array[2].x && poly->point_array[0].y == poly->point_array[1].y && poly->point_array[2].y == poly->point_array[3].y));
+}
+
+// triangulation: 2D triangulation of the polygons that aren't rectangles (see layerTriangulation)
+// hidden: faces to leave out (cull_hidden_faces), or NULL
+void triangulate(Array<Polygon *> &polygons, const layer_triangulation &triangulation, GrowBuffer<POSITIONS_TYPE> &positions_buffer, GrowBuffer<INDICES_TYPE> &indices_buffer, POSITIONS_TYPE zmin, POSITIONS_TYPE zmax, const positions_transform &transform, const hidden_faces *hidden, triangulation_stats &stats)
+{
+    trace_scope scope(TRACE_EXTRUSION);
+    uint64_t total_triangles = 0;
+    uint64_t total_vertices = 0;
+    uint64_t culled_triangles = 0;
+
+    int indices_offset = 0;
+    // std::vector<float> mesh_points_pos;
+    // std::vector<uint32_t> mesh_indices;
+    positions_buffer.reset();
+    indices_buffer.reset();
+
+    // Axis-aligned rectangles (usually many more than other types of polygons) are extruded together, with SIMD
+    // Counting pass: rectangles take 8 vertices, the other polygons about 2 * points vertices and 2 * (points - 2) + 2 * points
+    // triangles (the boxes of rectilinear polygons can add some, each polygon reserves its exact size below)
+    // Rectangles with hidden faces are extruded one by one, without those faces
+    thread_local rectangles_batch rectangles;
+    thread_local rectangles_batch culled_rectangles;
+    thread_local std::vector<uint32_t> culled_rectangles_faces;
+    rectangles.clear();
+    culled_rectangles.clear();
+    culled_rectangles_faces.clear();
+    uint64_t reserve_vertices = 0;
+    uint64_t reserve_indices = 0;
+    for (uint64_t j = 0; j < polygons.count; j++)
+    {
+        auto poly = polygons[j];
+        if (!isRectangle(poly))
+        {
+            const uint64_t points_count = poly->point_array.count;
+            reserve_vertices += 2 * points_count;
+            reserve_indices += points_count > 2 ? 6 * (points_count - 2) + 6 * points_count : 0;
+            continue;
+        }
+        reserve_vertices += RECTANGLE_VERTICES;
+        reserve_indices += RECTANGLE_INDICES;
+
+        float corners_x[4];
+        float corners_y[4];
+        for (int k = 0; k < 4; k++)
+        {
+            corners_x[k] = transform.x(poly->point_array[k].x);
+            corners_y[k] = transform.y(poly->point_array[k].y);
+        }
+
+        uint32_t faces = 0;
+        if (hidden != NULL)
+        {
+            for (int k = 0; k < 4; k++)
+                if (hidden->sideHidden(poly->point_array[k], poly->point_array[(k + 1) % 4]))
+                    faces |= RECTANGLE_FACE_SIDE0 << k;
+        }
+
+        if (faces == 0)
+        {
+            rectangles.add(corners_x, corners_y);
+        }
+        else
+        {
+            culled_rectangles.add(corners_x, corners_y);
+            culled_rectangles_faces.push_back(faces);
+        }
+    }
+
+    positions_buffer.reserve(reserve_vertices * 3);
+    indices_buffer.reserve(reserve_indices);
+
+    if (rectangles.size() > 0)
+    {
+        POSITIONS_TYPE *positions = positions_buffer.appendUninitialized(rectangles.size() * RECTANGLE_VERTICES * 3);
+        INDICES_TYPE *indices = indices_buffer.appendUninitialized(rectangles.size() * RECTANGLE_INDICES);
+        extrudeRectangles(rectangles, zmin, zmax, indices_offset, positions, indices);
+
+        indices_offset += rectangles.size() * RECTANGLE_VERTICES;
+        total_vertices += rectangles.size() * RECTANGLE_VERTICES;
+        total_triangles += rectangles.size() * RECTANGLE_INDICES / 3;
+    }
+
+    for (uint64_t r = 0; r < culled_rectangles.size(); r++)
+    {
+        const float x[4] = {culled_rectangles.x[0][r], culled_rectangles.x[1][r], culled_rectangles.x[2][r], culled_rectangles.x[3][r]};
+        const float y[4] = {culled_rectangles.y[0][r], culled_rectangles.y[1][r], culled_rectangles.y[2][r], culled_rectangles.y[3][r]};
+        POSITIONS_TYPE *positions = positions_buffer.appendUninitialized(RECTANGLE_VERTICES * 3);
+        INDICES_TYPE *indices = indices_buffer.appendUninitialized(RECTANGLE_INDICES);
+        const uint32_t indices_count = extrudeRectangleFaces(x, y, zmin, zmax, indices_offset, culled_rectangles_faces[r], positions, indices);
+        indices_buffer.truncate(indices_buffer.size() - (RECTANGLE_INDICES - indices_count));
+
+        indices_offset += RECTANGLE_VERTICES;
+        total_vertices += RECTANGLE_VERTICES;
+        total_triangles += indices_count / 3;
+        culled_triangles += (RECTANGLE_INDICES - indices_count) / 3;
+    }
+
+    uint64_t triangulated_idx = 0;
+    for (uint64_t j = 0; j < polygons.count; j++)
+    {
+        auto poly = polygons[j];
+
+        // Rectangles were already extruded in the batch
+        if (isRectangle(poly))
+            continue;
+
+        const layer_triangulation::polygon &poly_triangulation = triangulation.polygons[triangulated_idx++];
+        const Vec2 *poly_vertices = triangulation.vertices.data() + poly_triangulation.vertices_begin;
+        const uint32_t *poly_triangles = triangulation.triangles.data() + poly_triangulation.triangles_begin;
+        const uint32_t *mapping = poly_triangulation.mapping_begin != layer_triangulation::NO_MAPPING ? triangulation.mappings.data() + poly_triangulation.mapping_begin : NULL;
+        const int orientation = poly_triangulation.orientation;
+
+        total_triangles += poly_triangulation.triangles_count;
+        total_vertices += poly_triangulation.vertices_count;
+
+        // EXTRUSION
+
+        const int total_poly_vertices = poly_triangulation.vertices_count;
+        const int triangles_count = poly_triangulation.triangles_count;
+
+        // Exact sizes of this polygon, normally already covered by the layer reserve
+        // (outline_count is the number of walls of a split outline)
+        const uint64_t side_edges = poly_triangulation.outline_begin != layer_triangulation::NO_OUTLINE ? poly_triangulation.outline_count : poly->point_array.count;
+        positions_buffer.reserve(2 * total_poly_vertices * 3);
+        indices_buffer.reserve(2 * triangles_count * 3 + side_edges * 6);
+
+        // BOTTOM FACES
+        // (the vertices are always written, the side walls use them)
+        int bottom_indices_offset = indices_offset;
+        for (int i = 0; i < total_poly_vertices; i++)
+        {
+            positions_buffer.insertUnchecked(transform.x(poly_vertices[i].x));
+            positions_buffer.insertUnchecked(transform.y(poly_vertices[i].y));
+            positions_buffer.insertUnchecked((POSITIONS_TYPE)zmin);
+        }
+        for (int i = 0; i < triangles_count; i++)
+        {
+            indices_buffer.insertUnchecked((INDICES_TYPE)poly_triangles[3 * i + 2] + indices_offset);
+            indices_buffer.insertUnchecked((INDICES_TYPE)poly_triangles[3 * i + 1] + indices_offset);
+            indices_buffer.insertUnchecked((INDICES_TYPE)poly_triangles[3 * i] + indices_offset);
+        }
+        indices_offset += total_poly_vertices;
+
+        // TOP FACES
+        int top_indices_offset = indices_offset;
+        for (int i = 0; i < total_poly_vertices; i++)
+        {
+            positions_buffer.insertUnchecked(transform.x(poly_vertices[i].x));
+            positions_buffer.insertUnchecked(transform.y(poly_vertices[i].y));
+            positions_buffer.insertUnchecked((POSITIONS_TYPE)(zmax));
+        }
+        for (int i = 0; i < triangles_count; i++)
+        {
+            indices_buffer.insertUnchecked(poly_triangles[3 * i] + indices_offset);
+            indices_buffer.insertUnchecked(poly_triangles[3 * i + 1] + indices_offset);
+            indices_buffer.insertUnchecked(poly_triangles[3 * i + 2] + indices_offset);
+        }
+        indices_offset += total_poly_vertices;
+
+        // ToDo: We are assuming vertices are sorted like the edges of the polygon. It seems that is the case but might be worth do some extra checking
+        // ToDo: I had some issue with SKY130, INV4, LI1 layer, that has a hole (and a duplicated vertex?). The extrusion in the last segments is not closing well.
+        // EXTRUDE
+        // Without duplicated points, point i is vertex i (rectilinear polygons have more vertices after the points)
+        auto addWall = [&](int v0, int v1)
+        {
+            int ai0 = v0 + bottom_indices_offset;
+            int ai1 = v1 + bottom_indices_offset;
+            int ai2 = v0 + top_indices_offset;
+
+            int bi0 = v1 + bottom_indices_offset;
+            int bi1 = v1 + top_indices_offset;
+            int bi2 = v0 + top_indices_offset;
+
+            if (orientation == -1)
+            {
+                indices_buffer.insertUnchecked(ai0);
+                indices_buffer.insertUnchecked(ai1);
+                indices_buffer.insertUnchecked(ai2);
+
+                indices_buffer.insertUnchecked(bi0);
+                indices_buffer.insertUnchecked(bi1);
+                indices_buffer.insertUnchecked(bi2);
             }
             else
             {
-                for (int i = 0; i < total_poly_vertices; i++)
-                {
-                    if (orientation == -1)
-                    {
-                        indices_buffer.insert(i % total_poly_vertices + bottom_indices_offset);
-                        indices_buffer.insert((i + 1) % total_poly_vertices + bottom_indices_offset);
-                        indices_buffer.insert(i % total_poly_vertices + top_indices_offset);
+                indices_buffer.insertUnchecked(ai2);
+                indices_buffer.insertUnchecked(ai1);
+                indices_buffer.insertUnchecked(ai0);
 
-                        indices_buffer.insert((i + 1) % total_poly_vertices + bottom_indices_offset);
-                        indices_buffer.insert((i + 1) % total_poly_vertices + top_indices_offset);
-                        indices_buffer.insert(i % total_poly_vertices + top_indices_offset);
-                    }
-                    else
-                    {
-                        indices_buffer.insert(i % total_poly_vertices + top_indices_offset);
-                        indices_buffer.insert((i + 1) % total_poly_vertices + bottom_indices_offset);
-                        indices_buffer.insert(i % total_poly_vertices + bottom_indices_offset);
+                indices_buffer.insertUnchecked(bi2);
+                indices_buffer.insertUnchecked(bi1);
+                indices_buffer.insertUnchecked(bi0);
+            }
+        };
 
-                        indices_buffer.insert(i % total_poly_vertices + top_indices_offset);
-                        indices_buffer.insert((i + 1) % total_poly_vertices + top_indices_offset);
-                        indices_buffer.insert((i + 1) % total_poly_vertices + bottom_indices_offset);
-                    }
-                }
+        // Rectilinear polygons split the walls at the face vertices in the middle of the edges (see layer_triangulation::polygon)
+        const uint32_t *outline = poly_triangulation.outline_begin != layer_triangulation::NO_OUTLINE ? triangulation.outlines.data() + poly_triangulation.outline_begin : NULL;
+        const int points_count = poly->point_array.count;
+        for (int i = 0; i < points_count; i++)
+        {
+            const uint32_t splits = outline != NULL ? *outline++ : 0;
+            if (hidden != NULL && hidden->sideHidden(poly->point_array[i], poly->point_array[(i + 1) % points_count]))
+            {
+                culled_triangles += 2 * (splits + 1);
+                outline += splits;
+                continue;
+            }
+
+            int v0 = mapping != NULL ? mapping[i] : i;
+            const int v1 = mapping != NULL ? mapping[(i + 1) % points_count] : (i + 1) % points_count;
+            for (uint32_t k = 0; k < splits; k++)
+            {
+                addWall(v0, outline[k]);
+                v0 = outline[k];
             }
+            outline += splits;
+            addWall(v0, v1);
         }
     }
 
-    g_triangulation_stats.total_vertices += total_vertices;
-    g_triangulation_stats.total_triangles += total_triangles;
-
-    JS_gds_info_log("\t\t\tvertices: %" PRIu64 " triangles: %" PRIu64 "\n", total_vertices, total_triangles);
+    stats.total_vertices += total_vertices;
+    stats.total_triangles += total_triangles;
+    stats.culled_triangles += culled_triangles;
 }
 
-void createLineBuffers(Array<Polygon *> &polygons, GrowBuffer<POSITIONS_TYPE> &positions_buffer, GrowBuffer<INDICES_TYPE> &indices_buffer, float zmin, float zmax)
+void createLineBuffers(Array<Polygon *> &polygons, GrowBuffer<POSITIONS_TYPE> &positions_buffer, GrowBuffer<INDICES_TYPE> &indices_buffer, POSITIONS_TYPE zmin, POSITIONS_TYPE zmax, const positions_transform &transform)
 {
+    trace_scope scope(TRACE_EXTRUSION);
     positions_buffer.reset();
     indices_buffer.reset();
 
+    // Counting pass: per polygon 2 * points vertices and 2 * (points + 2) + 3 * points indices
+    uint64_t reserve_vertices = 0;
+    uint64_t reserve_indices = 0;
+    for (uint64_t j = 0; j < polygons.count; j++)
+    {
+        reserve_vertices += 2 * polygons[j]->point_array.count;
+        reserve_indices += 5 * polygons[j]->point_array.count + 4;
+    }
+    positions_buffer.reserve(reserve_vertices * 3);
+    indices_buffer.reserve(reserve_indices);
+
     int indices_offset = 0;
 
     for (uint64_t j = 0; j < polygons.count; j++)
@@ -847,15 +2221,15 @@ void createLineBuffers(Array<Polygon *> &polygons, GrowBuffer<POSITIONS_TYPE> &p
         for (uint64_t k = 0; k < points_count; k++)
         {
             auto point = poly->point_array[k];
-            positions_buffer.insert((POSITIONS_TYPE)point.x);
-            positions_buffer.insert((POSITIONS_TYPE)point.y);
-            positions_buffer.insert((POSITIONS_TYPE)zmin);
+            positions_buffer.insertUnchecked(transform.x(point.x));
+            positions_buffer.insertUnchecked(transform.y(point.y));
+            positions_buffer.insertUnchecked((POSITIONS_TYPE)zmin);
 
-            indices_buffer.insert((INDICES_TYPE)k + indices_offset);
+            indices_buffer.insertUnchecked((INDICES_TYPE)k + indices_offset);
         }
-        indices_buffer.insert((INDICES_TYPE)indices_offset);
+        indices_buffer.insertUnchecked((INDICES_TYPE)indices_offset);
         // Insert Primitive Restart Index to cut line drawing
-        indices_buffer.insert(RESTART_INDEX_VALUE);
+        indices_buffer.insertUnchecked(RESTART_INDEX_VALUE);
 
         indices_offset += points_count;
 
@@ -863,24 +2237,91 @@ void createLineBuffers(Array<Polygon *> &polygons, GrowBuffer<POSITIONS_TYPE> &p
         for (uint64_t k = 0; k < points_count; k++)
         {
             auto point = poly->point_array[k];
-            positions_buffer.insert((POSITIONS_TYPE)point.x);
-            positions_buffer.insert((POSITIONS_TYPE)point.y);
-            positions_buffer.insert((POSITIONS_TYPE)zmax);
+            positions_buffer.insertUnchecked(transform.x(point.x));
+            positions_buffer.insertUnchecked(transform.y(point.y));
+            positions_buffer.insertUnchecked((POSITIONS_TYPE)zmax);
 
-            indices_buffer.insert((INDICES_TYPE)k + indices_offset);
+            indices_buffer.insertUnchecked((INDICES_TYPE)k + indices_offset);
         }
-        indices_buffer.insert((INDICES_TYPE)indices_offset);
+        indices_buffer.insertUnchecked((INDICES_TYPE)indices_offset);
         // Insert Primitive Restart Index to cut line drawing
-        indices_buffer.insert(RESTART_INDEX_VALUE);
+        indices_buffer.insertUnchecked(RESTART_INDEX_VALUE);
 
         indices_offset += points_count;
 
         // Vertical lines
         for (uint64_t k = 0; k < points_count; k++)
         {
-            indices_buffer.insert((INDICES_TYPE)k + indices_offset - points_count);
-            indices_buffer.insert((INDICES_TYPE)k + indices_offset - 2 * points_count);
-            indices_buffer.insert(RESTART_INDEX_VALUE);
+            indices_buffer.insertUnchecked((INDICES_TYPE)k + indices_offset - points_count);
+            indices_buffer.insertUnchecked((INDICES_TYPE)k + indices_offset - 2 * points_count);
+            indices_buffer.insertUnchecked(RESTART_INDEX_VALUE);
         }
     }
 }
+
+// Merges the vertices that have exactly the same position and remaps the indices
+// Vertices are compacted in place (a vertex never moves to a higher index)
+void shareVertices(GrowBuffer<POSITIONS_TYPE> &positions_buffer, GrowBuffer<INDICES_TYPE> &indices_buffer)
+{
+    trace_scope scope(TRACE_EXTRUSION);
+    constexpr uint32_t EMPTY_SLOT = 0xffffffff;
+
+    // Reused between calls (one per thread)
+    thread_local std::vector<uint32_t> hash_table;
+    thread_local std::vector<uint32_t> remap;
+
+    // Positions are compared by their bits, they can be quantized int32 values (see POSITIONS_TYPE)
+    uint32_t *positions = (uint32_t *)positions_buffer.data;
+    const uint32_t vertices_count = positions_buffer.size() / 3;
+
+    uint64_t table_size = 16;
+    while (table_size < 2 * (uint64_t)vertices_count)
+        table_size *= 2;
+    hash_table.assign(table_size, EMPTY_SLOT);
+    remap.resize(vertices_count);
+
+    uint32_t shared_count = 0;
+    for (uint32_t i = 0; i < vertices_count; i++)
+    {
+        // -0 (sign bit only) and 0 are the same key. As a quantized int32 it would be INT32_MIN steps, which never happens
+        uint32_t bits[3];
+        for (int k = 0; k < 3; k++)
+        {
+            bits[k] = positions[i * 3 + k];
+            if (bits[k] == 0x80000000)
+                bits[k] = 0;
+        }
+        uint64_t hash = (bits[0] * 0x9E3779B97F4A7C15ULL) ^ (bits[1] * 0xC2B2AE3D27D4EB4FULL) ^ (bits[2] * 0x165667B19E3779F9ULL);
+        hash ^= hash >> 29;
+
+        uint64_t slot = hash & (table_size - 1);
+        while (true)
+        {
+            const uint32_t shared_idx = hash_table[slot];
+            if (shared_idx == EMPTY_SLOT)
+            {
+                hash_table[slot] = shared_count;
+                positions[shared_count * 3 + 0] = bits[0];
+                positions[shared_count * 3 + 1] = bits[1];
+                positions[shared_count * 3 + 2] = bits[2];
+                remap[i] = shared_count++;
+                break;
+            }
+            if (positions[shared_idx * 3 + 0] == bits[0] && positions[shared_idx * 3 + 1] == bits[1] && positions[shared_idx * 3 + 2] == bits[2])
+            {
+                remap[i] = shared_idx;
+                break;
+            }
+            slot = (slot + 1) & (table_size - 1);
+        }
+    }
+
+    INDICES_TYPE *indices = (INDICES_TYPE *)indices_buffer.data;
+    for (uint64_t i = 0; i < indices_buffer.size(); i++)
+    {
+        if (indices[i] != RESTART_INDEX_VALUE)
+            indices[i] = remap[indices[i]];
+    }
+
+    positions_buffer.truncate(shared_count * 3);
+}
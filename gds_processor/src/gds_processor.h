@@ -0,0 +1,272 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+#include <gdstk/gdstk.hpp>
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+#else
+#define EMSCRIPTEN_KEEPALIVE
+#endif
+
+#define ARRAY_LENGTH(some_array) (sizeof(some_array) / sizeof(some_array[0]))
+
+#define INDICES_TYPE uint32_t
+#define RESTART_INDEX_VALUE 0xffffffff
+// Positions are floats, or with quantized positions int32 values in the same 32 bits (see positions_transform), so they are
+// only copied around, never used in float arithmetic
+#define POSITIONS_TYPE float
+
+extern clock_t g_start_time;
+
+// Growable buffer of T items (stored as raw bytes)
+// Capacity grows geometrically, so appending N items costs O(N) copies overall. Sizes are 64 bits
+template <typename T>
+struct GrowBuffer
+{
+    uint64_t current_offset = 0;
+    uint64_t allocated_size = 0;
+    uint64_t items_count = 0;
+    unsigned char *data = NULL;
+
+    GrowBuffer(uint64_t reserveBufferSize)
+    {
+        assert(reserveBufferSize > 0);
+        data = (unsigned char *)malloc(reserveBufferSize);
+        assert(data);
+        allocated_size = reserveBufferSize;
+        current_offset = 0;
+        items_count = 0;
+    }
+    ~GrowBuffer()
+    {
+        if (data != NULL)
+            free(data);
+    }
+    GrowBuffer(const GrowBuffer &temp_obj) = delete;
+    GrowBuffer &operator=(const GrowBuffer &temp_obj) = delete;
+
+    // Clear the current offsets but doesn't free the memory
+    void reset()
+    {
+        current_offset = 0;
+        items_count = 0;
+    }
+
+    uint64_t size() const
+    {
+        return items_count;
+    }
+
+    // Drops the items after the first count
+    void truncate(uint64_t count)
+    {
+        assert(count <= items_count);
+        items_count = count;
+        current_offset = count * sizeof(T);
+    }
+
+    // Makes room for count more items, so the next count insertUnchecked/appendUninitialized don't need to grow
+    void reserve(uint64_t count)
+    {
+        const uint64_t required_size = current_offset + count * sizeof(T);
+        if (required_size <= allocated_size)
+            return;
+
+        uint64_t new_size = allocated_size * 2;
+        if (new_size < required_size)
+            new_size = required_size;
+
+        data = (unsigned char *)realloc(data, new_size);
+        assert(data);
+        allocated_size = new_size;
+    }
+
+    void insert(T value)
+    {
+        reserve(1);
+        insertUnchecked(value);
+    }
+
+    // Only after a reserve that covers it
+    void insertUnchecked(T value)
+    {
+        assert(current_offset + sizeof(value) <= allocated_size);
+        memcpy(data + current_offset, &value, sizeof(value));
+        current_offset += sizeof(value);
+        items_count++;
+    }
+
+    void append(const T *values, uint64_t count)
+    {
+        memcpy(appendUninitialized(count), values, count * sizeof(T));
+    }
+
+    // Adds count items without initializing them, returns where they start so the caller can write them
+    T *appendUninitialized(uint64_t count)
+    {
+        reserve(count);
+
+        T *values = (T *)(data + current_offset);
+        current_offset += count * sizeof(T);
+        items_count += count;
+        return values;
+    }
+};
+
+struct layer_stack_data
+{
+    gdstk::Tag tag;
+    char name[255];
+    double zmin;
+    double zmax;
+    layer_stack_data(gdstk::Tag tag, const char *name, double zmin, double zmax) : tag(tag), zmin(zmin), zmax(zmax)
+    {
+        strncpy(this->name, name, 255);
+        this->name[255 - 1] = '\0';
+    }
+};
+
+// Packed meshes (or lines) of one cell, handed to the output in a single call (JS_gds_add_cell_meshes)
+// Layout, 4 bytes aligned:
+//   cell_meshes_header
+//   cell_mesh_entry[entries_capacity] (only the first meshes_count are used)
+//   positions and indices of each mesh, at the offsets (bytes from the start of the blob) of its entry
+#define CELL_MESHES_FLAG_LINES 1
+#define CELL_MESHES_FLAG_QUANTIZED 2
+// Bounding box of each layer, emitted before the real meshes of the cell (progressive_emission option)
+#define CELL_MESHES_FLAG_PLACEHOLDER 4
+
+// cell_mesh_entry positions_format
+#define CELL_MESH_POSITIONS_FLOAT32 0
+#define CELL_MESH_POSITIONS_INT16 1
+#define CELL_MESH_POSITIONS_INT32 2
+
+struct cell_meshes_header
+{
+    uint32_t meshes_count;
+    // One entry per layer, plus one per coarse level of detail of each layer (lod_levels process option)
+    uint32_t entries_capacity;
+    uint32_t flags;
+    uint32_t reserved;
+    // Dequantization of the INT16/INT32 positions: x = origin_x + qx * step, y = origin_y + qy * step
+    // origin is the min of the cell bounding box and step the database precision in user units
+    double origin_x;
+    double origin_y;
+    double step;
+};
+
+struct cell_mesh_entry
+{
+    uint32_t layer_number;
+    uint32_t layer_datatype;
+    // Index in g_layer_stack
+    uint32_t layer_idx;
+    uint32_t positions_offset;
+    uint32_t positions_count;
+    uint32_t indices_offset;
+    uint32_t indices_count;
+    // Bytes per index: 2 (uint16) or 4 (uint32). The primitive restart index is the max value of the type
+    uint32_t index_size;
+    uint32_t positions_format;
+    // Quantized positions store the index of their z in this table (0: zmin, 1: zmax)
+    float z_levels[2];
+    // 0 for the full detail mesh. Coarse levels (see gds_lod.h) are drawn instead of it when the larger side
+    // of the cell takes less than lod_max_screen_size pixels on screen
+    uint32_t lod_level;
+    float lod_max_screen_size;
+};
+
+// Labels of one cell, handed to the output in a single call (JS_gds_add_cell_labels)
+// Layout, 4 bytes aligned:
+//   cell_labels_header
+//   float positions[labels_count * 3] (x, y, z)
+//   uint32_t layers[labels_count] (layer_number | layer_datatype << 16)
+//   uint32_t texts[labels_count] (index in the string table)
+//   uint32_t string_offsets[strings_count + 1] (bytes from the start of the strings, string i ends where i + 1 starts)
+//   strings, UTF-8 without terminator. Each distinct text is stored once
+struct cell_labels_header
+{
+    uint32_t labels_count;
+    uint32_t strings_count;
+    uint32_t strings_size;
+    uint32_t reserved;
+};
+
+// References of all the cells, handed to the output in a single call (JS_gds_add_references)
+// Layout, 8 bytes aligned:
+//   references_header
+//   uint32_t string_offsets[strings_count + 1] (bytes from the start of the strings, string i ends where i + 1 starts)
+//   strings, UTF-8 without terminator. Cell and instance names are stored once and referenced by index
+//   reference_entry[references_count], at entries_offset (bytes from the start of the blob)
+struct references_header
+{
+    uint32_t strings_count;
+    uint32_t strings_size;
+    uint32_t references_count;
+    uint32_t entries_offset;
+};
+
+// One reference, or a columns x rows array of it (Rectangular and Regular repetitions): instance (c, r) is at
+// origin + c * v1 + r * v2. Explicit repetitions are written as one entry per offset
+struct reference_entry
+{
+    double origin_x;
+    double origin_y;
+    double rotation;
+    double v1_x;
+    double v1_y;
+    double v2_x;
+    double v2_y;
+    // Indexes in the string table
+    uint32_t parent_cell_name;
+    uint32_t cell_name;
+    uint32_t instance_name;
+    uint32_t x_reflection;
+    uint32_t columns;
+    uint32_t rows;
+};
+static_assert(sizeof(reference_entry) == 80, "GDS.addReferences (GDS_data.js) reads 80 bytes entries");
+extern gdstk::Array<layer_stack_data> g_layer_stack;
+
+// Memory of the processor: the wasm heap in the browser build, the process in the native one
+struct memory_stats
+{
+    // Bytes allocated (malloc) now
+    uint64_t used;
+    // High-water mark. The wasm memory never shrinks, so this is what a layout needs to load at all
+    uint64_t peak;
+    // Memory reserved now (wasm memory size, resident set natively)
+    uint64_t reserved;
+};
+// Implemented with the output sink (gds_output_wasm.cpp, gds_output_native.cpp)
+memory_stats getMemoryStats();
+
+// Output sink
+// Everything processGDS/processCells/processRegion produce goes through these functions.
+// gds_output_wasm.cpp forwards them to the worker JS (EM_ASM), gds_output_native.cpp implements them for the native CLI build
+void JS_gds_info_log(const char *format, ...);
+void JS_gds_stats(const char *design_name, gdstk::LibraryInfo &info, const memory_stats &memory);
+void JS_gds_add_cell(const char *cell_name, gdstk::Vec2 &min, gdstk::Vec2 &max, bool is_top_cell);
+void JS_gds_add_cell_meshes(const char *cell_name, GrowBuffer<unsigned char> &cell_meshes);
+void JS_gds_add_cell_labels(const char *cell_name, GrowBuffer<unsigned char> &cell_labels);
+// The cell has the meshes of source_cell_name (already emitted) moved by offset (alias_identical_cells)
+void JS_gds_add_cell_alias(const char *cell_name, const char *source_cell_name, double offset_x, double offset_y);
+void JS_gds_add_references(GrowBuffer<unsigned char> &references);
+void JS_gds_finished_references();
+void JS_gds_finished_placeholders();
+void JS_gds_process_progress(float progress);
+
+extern "C"
+{
+    void addProcessLayer(uint32_t layer_number, uint32_t layer_datatype, const char *name, double layer_zmin, double layer_zmax);
+    void clearProcessLayers();
+    void setProcessOption(const char *name, double value);
+    void processGDS(const char *gds_filepath, bool opt_just_lines);
+    void processCells(bool opt_just_lines);
+    void resetProcessedCells();
+    uint32_t processRegion(double min_x, double min_y, double max_x, double max_y, uint32_t budget, bool opt_just_lines);
+    bool writeTrace(const char *filepath);
+}
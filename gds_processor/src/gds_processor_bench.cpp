@@ -0,0 +1,474 @@
+// Benchmark for the gds_processor pipeline
+// Generates a synthetic, reproducible layout with gdstk (rectangles, non-Manhattan polygons with holes,
+// a deep reference hierarchy, a large repetition array and labels), writes it to a GDS file and runs
+// processGDS + processCells on it in triangles and lines modes, reporting throughput and peak memory
+
+#include <chrono>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "gds_processor.h"
+#include "gds_output_native.h"
+
+using namespace gdstk;
+
+struct bench_params
+{
+    uint64_t rectangles = 200000;
+    uint64_t polygons = 20000;
+    uint64_t labels = 20000;
+    uint64_t depth = 4;
+    uint64_t fanout = 4;
+    uint64_t array_columns = 100;
+    uint64_t array_rows = 100;
+    uint64_t seed = 1;
+    int runs = 1;
+    int threads = 1;
+    bool shared_vertices = false;
+    bool quantized_positions = false;
+    bool merge_layers = false;
+    bool cull_hidden_faces = false;
+    int lod_levels = 0;
+    bool triangulation_cache = false;
+};
+
+// Shapes stored in the generated library (each cell counted once, not flattened)
+struct bench_counts
+{
+    uint64_t polygons = 0;
+    uint64_t references = 0;
+    uint64_t labels = 0;
+};
+
+struct bench_layer
+{
+    uint32_t layer_number;
+    uint32_t layer_datatype;
+    const char *name;
+    double zmin;
+    double zmax;
+};
+
+// Subset of SKY130 used by the generator
+static const bench_layer bench_layers[] = {
+    {65, 20, "diff", -0.5, 0.01},
+    {66, 20, "poly", 0, 0.18},
+    {67, 20, "li1", 0.936, 1.136},
+    {68, 20, "met1", 1.376, 1.736},
+    {68, 44, "via", 1.73, 2},
+    {69, 20, "met2", 2, 2.36},
+    {70, 20, "met3", 2.786, 3.631},
+    {71, 20, "met4", 4.0211, 4.8661},
+    {72, 20, "met5", 5.371, 6.6311},
+};
+
+// Label layers, shown over the bench layers with the same layer number
+static const Tag bench_label_tags[] = {make_tag(67, 5), make_tag(68, 5), make_tag(69, 5), make_tag(70, 5), make_tag(71, 5), make_tag(72, 5)};
+
+static uint64_t g_rng_state = 1;
+
+// xorshift64*, so the generated layout only depends on the seed
+static double random01()
+{
+    g_rng_state ^= g_rng_state >> 12;
+    g_rng_state ^= g_rng_state << 25;
+    g_rng_state ^= g_rng_state >> 27;
+    return (double)((g_rng_state * 0x2545F4914F6CDD1DULL) >> 11) / (double)(1ULL << 53);
+}
+
+static double randomRange(double min, double max)
+{
+    return min + (max - min) * random01();
+}
+
+static Tag randomLayerTag()
+{
+    const bench_layer &layer = bench_layers[(uint64_t)(random01() * ARRAY_LENGTH(bench_layers))];
+    return make_tag(layer.layer_number, layer.layer_datatype);
+}
+
+static Cell *newCell(const char *name)
+{
+    Cell *cell = (Cell *)allocate_clear(sizeof(Cell));
+    cell->name = copy_string(name, NULL);
+    return cell;
+}
+
+static void addRectangle(Cell *cell, double x, double y, double size_x, double size_y, Tag tag)
+{
+    Polygon *poly = (Polygon *)allocate_clear(sizeof(Polygon));
+    *poly = rectangle(Vec2{x, y}, Vec2{x + size_x, y + size_y}, tag);
+    cell->polygon_array.append(poly);
+}
+
+// Regular polygon with a concentric hole, stored the way GDS stores holes (keyhole through a cut line)
+static void addPolygonWithHole(Cell *cell, double x, double y, double radius, uint64_t sides, Tag tag)
+{
+    Polygon *poly = (Polygon *)allocate_clear(sizeof(Polygon));
+    poly->tag = tag;
+    poly->point_array.ensure_slots(2 * sides + 2);
+
+    const double rotation = randomRange(0, M_PI);
+    const double hole_radius = radius * 0.4;
+    for (uint64_t i = 0; i <= sides; i++)
+    {
+        double angle = rotation + 2 * M_PI * (i % sides) / sides;
+        poly->point_array.append_unsafe(Vec2{x + radius * cos(angle), y + radius * sin(angle)});
+    }
+    for (uint64_t i = 0; i <= sides; i++)
+    {
+        double angle = rotation - 2 * M_PI * (i % sides) / sides;
+        poly->point_array.append_unsafe(Vec2{x + hole_radius * cos(angle), y + hole_radius * sin(angle)});
+    }
+
+    cell->polygon_array.append(poly);
+}
+
+static void addLabel(Cell *cell, double x, double y, uint64_t index)
+{
+    char text[64];
+    snprintf(text, sizeof(text), "pin_%" PRIu64, index);
+
+    Label *label = (Label *)allocate_clear(sizeof(Label));
+    label->tag = bench_label_tags[index % ARRAY_LENGTH(bench_label_tags)];
+    label->text = copy_string(text, NULL);
+    label->origin = Vec2{x, y};
+    label->anchor = Anchor::O;
+    label->magnification = 1;
+    cell->label_array.append(label);
+}
+
+static Reference *addReference(Cell *cell, Cell *child, double x, double y, uint64_t index)
+{
+    char instance_name[64];
+    snprintf(instance_name, sizeof(instance_name), "inst_%" PRIu64, index);
+
+    Reference *ref = (Reference *)allocate_clear(sizeof(Reference));
+    ref->type = ReferenceType::Cell;
+    ref->cell = child;
+    ref->origin = Vec2{x, y};
+    ref->magnification = 1;
+    ref->rotation = (index % 4) * M_PI / 2;
+    ref->x_reflection = (index % 3) == 0;
+    set_gds_property(ref->properties, 61, instance_name, strlen(instance_name));
+    cell->reference_array.append(ref);
+    return ref;
+}
+
+static void generateBenchLibrary(const bench_params &params, const char *gds_filepath, bench_counts &counts)
+{
+    g_rng_state = params.seed ? params.seed : 1;
+
+    Library lib = {};
+    lib.init("bench", 1e-6, 1e-9);
+
+    // Leaf cells: a few Manhattan shapes, non-Manhattan shapes and labels, like standard cells
+    constexpr uint64_t leaf_cells_count = 8;
+    constexpr double leaf_size = 5;
+    Cell *leaf_cells[leaf_cells_count];
+    for (uint64_t i = 0; i < leaf_cells_count; i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "bench_leaf_%" PRIu64, i);
+        Cell *cell = newCell(name);
+        for (int j = 0; j < 16; j++)
+        {
+            addRectangle(cell, randomRange(0, leaf_size), randomRange(0, leaf_size), randomRange(0.14, 1), randomRange(0.14, 2), randomLayerTag());
+            counts.polygons++;
+        }
+        for (int j = 0; j < 2; j++)
+        {
+            addPolygonWithHole(cell, randomRange(1, leaf_size - 1), randomRange(1, leaf_size - 1), randomRange(0.3, 1), 8, randomLayerTag());
+            counts.polygons++;
+        }
+        for (int j = 0; j < 2; j++)
+        {
+            addLabel(cell, randomRange(0, leaf_size), randomRange(0, leaf_size), counts.labels++);
+        }
+        lib.cell_array.append(cell);
+        leaf_cells[i] = cell;
+    }
+
+    // Reference hierarchy: each level places "fanout" instances of cells from the level below
+    Cell *level_cell = leaf_cells[0];
+    double level_size = leaf_size;
+    for (uint64_t level = 1; level <= params.depth; level++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "bench_level_%" PRIu64, level);
+        Cell *cell = newCell(name);
+        for (uint64_t j = 0; j < params.fanout; j++)
+        {
+            Cell *child = (level == 1) ? leaf_cells[j % leaf_cells_count] : level_cell;
+            addReference(cell, child, j * level_size * 1.1, 0, counts.references);
+            counts.references++;
+        }
+        addRectangle(cell, 0, -1, params.fanout * level_size * 1.1, 0.5, make_tag(68, 20));
+        counts.polygons++;
+        lib.cell_array.append(cell);
+        level_cell = cell;
+        level_size = level_size * params.fanout * 1.1;
+    }
+
+    // Top cell
+    Cell *top_cell = newCell("bench_top");
+    const double die_size = 2 * sqrt((double)params.rectangles + params.polygons) + 100;
+
+    for (uint64_t i = 0; i < params.rectangles; i++)
+    {
+        bool horizontal = random01() < 0.5;
+        double width = randomRange(0.14, 2);
+        double length = randomRange(0.5, 20);
+        addRectangle(top_cell, randomRange(0, die_size), randomRange(0, die_size), horizontal ? length : width, horizontal ? width : length, randomLayerTag());
+        counts.polygons++;
+    }
+
+    for (uint64_t i = 0; i < params.polygons; i++)
+    {
+        static const uint64_t sides[] = {6, 8, 12};
+        addPolygonWithHole(top_cell, randomRange(0, die_size), randomRange(0, die_size), randomRange(0.5, 3), sides[i % ARRAY_LENGTH(sides)], randomLayerTag());
+        counts.polygons++;
+    }
+
+    for (uint64_t i = 0; i < params.labels; i++)
+    {
+        addLabel(top_cell, randomRange(0, die_size), randomRange(0, die_size), counts.labels++);
+    }
+
+    if (params.depth > 0)
+    {
+        addReference(top_cell, level_cell, 0, -level_size, counts.references);
+        counts.references++;
+    }
+
+    if (params.array_columns > 0 && params.array_rows > 0)
+    {
+        Reference *ref = addReference(top_cell, leaf_cells[0], 0, die_size + leaf_size, counts.references);
+        ref->rotation = 0;
+        ref->x_reflection = false;
+        ref->repetition.type = RepetitionType::Rectangular;
+        ref->repetition.columns = params.array_columns;
+        ref->repetition.rows = params.array_rows;
+        ref->repetition.spacing = Vec2{leaf_size * 1.2, leaf_size * 1.2};
+        counts.references++;
+    }
+
+    lib.cell_array.append(top_cell);
+
+    lib.write_gds(gds_filepath, 0, NULL);
+    lib.free_all();
+}
+
+static void addBenchLayers(double z_offset)
+{
+    for (uint64_t i = 0; i < ARRAY_LENGTH(bench_layers); i++)
+    {
+        const bench_layer &layer = bench_layers[i];
+        addProcessLayer(layer.layer_number, layer.layer_datatype, layer.name, layer.zmin + z_offset, layer.zmax + z_offset);
+    }
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double peakRSSMegabytes()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    // ru_maxrss is in kilobytes on Linux
+    return usage.ru_maxrss / 1024.0;
+}
+
+static void runBenchmark(const char *mode_name, bool opt_just_lines, const char *gds_filepath, const bench_params &params, const bench_counts &counts)
+{
+    double best_gds_seconds = 0;
+    double best_cells_seconds = 0;
+    native_output_stats best_stats;
+
+    for (int run = 0; run < params.runs; run++)
+    {
+        g_native_output_stats = native_output_stats();
+
+        auto start = std::chrono::steady_clock::now();
+        processGDS(gds_filepath, opt_just_lines);
+        double gds_seconds = secondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        processCells(opt_just_lines);
+        double cells_seconds = secondsSince(start);
+
+        if (run == 0 || gds_seconds + cells_seconds < best_gds_seconds + best_cells_seconds)
+        {
+            best_gds_seconds = gds_seconds;
+            best_cells_seconds = cells_seconds;
+            best_stats = g_native_output_stats;
+        }
+    }
+
+    double polygons_per_second = best_cells_seconds > 0 ? counts.polygons / best_cells_seconds : 0;
+    double triangles_per_second = (!opt_just_lines && best_cells_seconds > 0) ? (best_stats.indices_count / 3) / best_cells_seconds : 0;
+
+    printf("%-10s %12.3f %14.3f %14.0f %14.0f %12.2f %12.1f\n",
+           mode_name,
+           best_gds_seconds,
+           best_cells_seconds,
+           polygons_per_second,
+           triangles_per_second,
+           best_stats.bytes_emitted / (1024.0 * 1024.0),
+           peakRSSMegabytes());
+}
+
+// Processes the cells, then again after changing the layer stack z values (what the triangulation cache is for)
+// Only the second processCells is reported
+static void runReprocessBenchmark(const char *gds_filepath, const bench_counts &counts)
+{
+    auto start = std::chrono::steady_clock::now();
+    processGDS(gds_filepath, false);
+    double gds_seconds = secondsSince(start);
+    processCells(false);
+
+    clearProcessLayers();
+    addBenchLayers(1.0);
+    resetProcessedCells();
+
+    g_native_output_stats = native_output_stats();
+    start = std::chrono::steady_clock::now();
+    processCells(false);
+    double cells_seconds = secondsSince(start);
+
+    clearProcessLayers();
+    addBenchLayers(0);
+
+    const native_output_stats &stats = g_native_output_stats;
+    printf("%-10s %12.3f %14.3f %14.0f %14.0f %12.2f %12.1f\n",
+           "reprocess",
+           gds_seconds,
+           cells_seconds,
+           cells_seconds > 0 ? counts.polygons / cells_seconds : 0,
+           cells_seconds > 0 ? (stats.indices_count / 3) / cells_seconds : 0,
+           stats.bytes_emitted / (1024.0 * 1024.0),
+           peakRSSMegabytes());
+}
+
+static void printUsage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "\t--rectangles <n>\tRectangles in the top cell\n");
+    fprintf(stderr, "\t--polygons <n>\t\tNon-Manhattan polygons with holes in the top cell\n");
+    fprintf(stderr, "\t--labels <n>\t\tLabels in the top cell\n");
+    fprintf(stderr, "\t--depth <n>\t\tReference hierarchy depth\n");
+    fprintf(stderr, "\t--fanout <n>\t\tReferences per hierarchy level\n");
+    fprintf(stderr, "\t--array <columns> <rows>\tRepetition array of a leaf cell in the top cell\n");
+    fprintf(stderr, "\t--seed <n>\t\tRandom seed\n");
+    fprintf(stderr, "\t--runs <n>\t\tRuns per mode (the fastest one is reported)\n");
+    fprintf(stderr, "\t--threads <n>\t\tWorker threads for processCells\n");
+    fprintf(stderr, "\t--shared-vertices\tShare the vertices with the same position inside each mesh\n");
+    fprintf(stderr, "\t--quantized\t\tQuantized integer positions relative to the cell bounding box\n");
+    fprintf(stderr, "\t--merge\t\t\tMerge the overlapping polygons of each layer\n");
+    fprintf(stderr, "\t--cull\t\t\tCull the hidden faces (walls between abutting polygons, faces resting on the next layer)\n");
+    fprintf(stderr, "\t--lod <levels>\t\tCoarse levels of detail per cell layer (0-2)\n");
+    fprintf(stderr, "\t--triangulation-cache\tKeep the 2D triangulations, and time processing the cells again with new layer z values\n");
+    fprintf(stderr, "\t--shuttle\t\tFull-chip sized preset\n");
+    fprintf(stderr, "\t--keep <file.gds>\tWrite the generated layout to this file and keep it\n");
+}
+
+int main(int argc, char **argv)
+{
+    bench_params params;
+    const char *keep_filepath = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--rectangles") == 0 && has_value)
+            params.rectangles = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--polygons") == 0 && has_value)
+            params.polygons = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--labels") == 0 && has_value)
+            params.labels = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--depth") == 0 && has_value)
+            params.depth = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--fanout") == 0 && has_value)
+            params.fanout = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--array") == 0 && i + 2 < argc)
+        {
+            params.array_columns = strtoull(argv[++i], NULL, 10);
+            params.array_rows = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && has_value)
+            params.seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--runs") == 0 && has_value)
+            params.runs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && has_value)
+            params.threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--shared-vertices") == 0)
+            params.shared_vertices = true;
+        else if (strcmp(argv[i], "--quantized") == 0)
+            params.quantized_positions = true;
+        else if (strcmp(argv[i], "--merge") == 0)
+            params.merge_layers = true;
+        else if (strcmp(argv[i], "--cull") == 0)
+            params.cull_hidden_faces = true;
+        else if (strcmp(argv[i], "--lod") == 0 && has_value)
+            params.lod_levels = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--triangulation-cache") == 0)
+            params.triangulation_cache = true;
+        else if (strcmp(argv[i], "--shuttle") == 0)
+        {
+            params.rectangles = 2000000;
+            params.polygons = 100000;
+            params.labels = 50000;
+            params.depth = 6;
+            params.fanout = 6;
+            params.array_columns = 500;
+            params.array_rows = 500;
+        }
+        else if (strcmp(argv[i], "--keep") == 0 && has_value)
+            keep_filepath = argv[++i];
+        else
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (params.runs < 1)
+        params.runs = 1;
+
+    char gds_filepath[256];
+    if (keep_filepath != NULL)
+        snprintf(gds_filepath, sizeof(gds_filepath), "%s", keep_filepath);
+    else
+        snprintf(gds_filepath, sizeof(gds_filepath), "/tmp/gds_processor_bench_%d.gds", (int)getpid());
+
+    bench_counts counts;
+    auto start = std::chrono::steady_clock::now();
+    generateBenchLibrary(params, gds_filepath, counts);
+    double generate_seconds = secondsSince(start);
+
+    addBenchLayers(0);
+
+    setProcessOption("threads", params.threads);
+    setProcessOption("shared_vertices", params.shared_vertices);
+    setProcessOption("quantized_positions", params.quantized_positions);
+    setProcessOption("merge_layers", params.merge_layers);
+    setProcessOption("cull_hidden_faces", params.cull_hidden_faces);
+    setProcessOption("lod_levels", params.lod_levels);
+    setProcessOption("triangulation_cache", params.triangulation_cache);
+
+    printf("layout: rectangles %" PRIu64 ", polygons with holes %" PRIu64 ", labels %" PRIu64 ", depth %" PRIu64 "x%" PRIu64 ", array %" PRIu64 "x%" PRIu64 ", seed %" PRIu64 "\n",
+           params.rectangles, params.polygons, params.labels, params.depth, params.fanout, params.array_columns, params.array_rows, params.seed);
+    printf("library: polygons %" PRIu64 ", references %" PRIu64 ", labels %" PRIu64 " (generated in %.3f s)\n\n", counts.polygons, counts.references, counts.labels, generate_seconds);
+
+    printf("%-10s %12s %14s %14s %14s %12s %12s\n", "mode", "processGDS s", "processCells s", "polygons/s", "triangles/s", "MB emitted", "peak RSS MB");
+    runBenchmark("triangles", false, gds_filepath, params, counts);
+    runBenchmark("lines", true, gds_filepath, params, counts);
+    if (params.triangulation_cache)
+        runReprocessBenchmark(gds_filepath, counts);
+
+    if (keep_filepath == NULL)
+        remove(gds_filepath);
+
+    return 0;
+}
@@ -0,0 +1,212 @@
+// Native driver for the gds_processor pipeline
+// Runs processGDS + processCells (or processRegion) on a GDS/OAS file outside the browser, so the pipeline can be profiled with perf, valgrind, sanitizers, etc
+
+#include <chrono>
+#include "gds_processor.h"
+#include "gds_output_native.h"
+#include "gds_trace.h"
+
+static void printUsage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [options] <input.gds|input.oas> <layer_stack.txt>\n", program);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "\t-o <file.obj>\tWrite the generated meshes to an OBJ file\n");
+    fprintf(stderr, "\t-l\t\tGenerate lines instead of triangles (opt_just_lines)\n");
+    fprintf(stderr, "\t-j <threads>\tWorker threads for processCells\n");
+    fprintf(stderr, "\t-s\t\tShare the vertices with the same position inside each mesh\n");
+    fprintf(stderr, "\t-q\t\tQuantized integer positions relative to the cell bounding box\n");
+    fprintf(stderr, "\t-m\t\tMerge the overlapping polygons of each layer\n");
+    fprintf(stderr, "\t-d levels\tCoarse levels of detail per cell layer (0-2)\n");
+    fprintf(stderr, "\t-p\t\tProgressive emission: cells by visual importance, after a bounding box placeholder of each one\n");
+    fprintf(stderr, "\t-c\t\tCull the hidden faces (walls between abutting polygons, faces resting on the next layer)\n");
+    fprintf(stderr, "\t-r x0,y0,x1,y1\tOnly process the cells visible in that rectangle of the top cell (processRegion)\n");
+    fprintf(stderr, "\t-k\t\tReuse the triangulation of translated copies of a polygon (shape cache)\n");
+    fprintf(stderr, "\t-a\t\tBuild once the cells with the same shapes, emit the copies as aliases\n");
+    fprintf(stderr, "\t-g\t\tFree the shapes and labels of each cell once it is emitted\n");
+    fprintf(stderr, "\t-t <file.json>\tTime the processing stages: write a Chrome trace and print a summary\n");
+    fprintf(stderr, "\t-v\t\tPrint the processing log to stderr, with every cell and layer\n");
+}
+
+static void printStdout(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+// Layer stack file: one layer per line, "layer/datatype name zmin zmax". Lines starting with '#' are ignored
+static int loadLayerStack(const char *filepath)
+{
+    FILE *file = fopen(filepath, "r");
+    if (file == NULL)
+        return -1;
+
+    int layers_count = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), file))
+    {
+        uint32_t layer_number, layer_datatype;
+        char name[255];
+        double zmin, zmax;
+
+        if (line[0] == '#')
+            continue;
+        if (sscanf(line, "%u/%u %254s %lf %lf", &layer_number, &layer_datatype, name, &zmin, &zmax) != 5)
+            continue;
+
+        addProcessLayer(layer_number, layer_datatype, name, zmin, zmax);
+        layers_count++;
+    }
+
+    fclose(file);
+    return layers_count;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    const char *input_filepath = NULL;
+    const char *layers_filepath = NULL;
+    const char *output_filepath = NULL;
+    const char *trace_filepath = NULL;
+    bool opt_just_lines = false;
+    bool opt_region = false;
+    double region[4] = {};
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            output_filepath = argv[++i];
+        else if (strcmp(argv[i], "-l") == 0)
+            opt_just_lines = true;
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            setProcessOption("threads", atoi(argv[++i]));
+        else if (strcmp(argv[i], "-s") == 0)
+            setProcessOption("shared_vertices", 1);
+        else if (strcmp(argv[i], "-q") == 0)
+            setProcessOption("quantized_positions", 1);
+        else if (strcmp(argv[i], "-m") == 0)
+            setProcessOption("merge_layers", 1);
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+            setProcessOption("lod_levels", atoi(argv[++i]));
+        else if (strcmp(argv[i], "-p") == 0)
+            setProcessOption("progressive_emission", 1);
+        else if (strcmp(argv[i], "-c") == 0)
+            setProcessOption("cull_hidden_faces", 1);
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+        {
+            opt_region = sscanf(argv[++i], "%lf,%lf,%lf,%lf", &region[0], &region[1], &region[2], &region[3]) == 4;
+            if (!opt_region)
+            {
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-k") == 0)
+            setProcessOption("shape_cache", 1);
+        else if (strcmp(argv[i], "-a") == 0)
+            setProcessOption("alias_identical_cells", 1);
+        else if (strcmp(argv[i], "-g") == 0)
+            setProcessOption("release_geometry", 1);
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            trace_filepath = argv[++i];
+            setProcessOption("trace", 1);
+        }
+        else if (strcmp(argv[i], "-v") == 0)
+        {
+            nativeOutputSetVerbose(true);
+            setProcessOption("log_cells", 1);
+        }
+        else if (argv[i][0] == '-')
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+        else if (input_filepath == NULL)
+            input_filepath = argv[i];
+        else if (layers_filepath == NULL)
+            layers_filepath = argv[i];
+    }
+
+    if (input_filepath == NULL || layers_filepath == NULL)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    FILE *input_file = fopen(input_filepath, "rb");
+    if (input_file == NULL)
+    {
+        fprintf(stderr, "Unable to open %s\n", input_filepath);
+        return 1;
+    }
+    fclose(input_file);
+
+    if (loadLayerStack(layers_filepath) <= 0)
+    {
+        fprintf(stderr, "No layers loaded from %s\n", layers_filepath);
+        return 1;
+    }
+
+    if (output_filepath != NULL && !nativeOutputOpen(output_filepath))
+    {
+        fprintf(stderr, "Unable to create %s\n", output_filepath);
+        return 1;
+    }
+
+    auto total_start = std::chrono::steady_clock::now();
+
+    auto phase_start = std::chrono::steady_clock::now();
+    processGDS(input_filepath, opt_just_lines);
+    double process_gds_seconds = secondsSince(phase_start);
+
+    phase_start = std::chrono::steady_clock::now();
+    if (opt_region)
+        processRegion(region[0], region[1], region[2], region[3], 0, opt_just_lines);
+    else
+        processCells(opt_just_lines);
+    double process_cells_seconds = secondsSince(phase_start);
+
+    double total_seconds = secondsSince(total_start);
+
+    nativeOutputClose();
+
+    const native_output_stats &stats = g_native_output_stats;
+    printf("\n");
+    printf("output:\n");
+    printf("\tcells: %" PRIu64 "\n", stats.cells);
+    printf("\treferences: %" PRIu64 "\n", stats.references);
+    printf("\tmeshes: %" PRIu64 "\n", stats.meshes);
+    printf("\tlines: %" PRIu64 "\n", stats.lines);
+    printf("\taliases: %" PRIu64 "\n", stats.aliases);
+    printf("\tlabels: %" PRIu64 "\n", stats.labels);
+    printf("\tvertices: %" PRIu64 "\n", stats.positions_count / 3);
+    printf("\tindices: %" PRIu64 "\n", stats.indices_count);
+    printf("\tbytes: %" PRIu64 "\n", stats.bytes_emitted);
+
+    printf("\n");
+    printf("timings (s):\n");
+    printf("\tprocessGDS: %.3f\n", process_gds_seconds);
+    printf("\t%s: %.3f\n", opt_region ? "processRegion" : "processCells", process_cells_seconds);
+    printf("\t\toutput write: %.3f\n", stats.output_seconds);
+    printf("\ttotal: %.3f\n", total_seconds);
+
+    if (trace_filepath != NULL)
+    {
+        printf("\n");
+        tracePrintSummary(printStdout);
+        if (!writeTrace(trace_filepath))
+        {
+            fprintf(stderr, "Unable to write %s\n", trace_filepath);
+            return 1;
+        }
+    }
+
+    return 0;
+}
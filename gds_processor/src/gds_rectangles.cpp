@@ -0,0 +1,193 @@
+#include "gds_processor.h"
+#include "gds_rectangles.h"
+
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static_assert(sizeof(POSITIONS_TYPE) == sizeof(float) && sizeof(INDICES_TYPE) == sizeof(uint32_t), "extrudeRectangles writes float positions and uint32 indices");
+
+// Triangles of one extruded rectangle: bottom face (vertices 0-3), top face (4-7) and the 4 sides
+alignas(16) static const uint32_t g_rectangle_indices[RECTANGLE_INDICES] = {
+    0, 1, 2, 0, 2, 3,
+    4, 5, 6, 4, 6, 7,
+    4, 1, 0, 4, 5, 1,
+    5, 2, 1, 5, 6, 2,
+    6, 3, 2, 6, 7, 3,
+    7, 0, 3, 7, 4, 0};
+
+static void extrudeRectangle(const float x[4], const float y[4], float zmin, float zmax, uint32_t first_index, float *positions, uint32_t *indices)
+{
+    for (int k = 0; k < 4; k++)
+    {
+        positions[k * 3 + 0] = x[k];
+        positions[k * 3 + 1] = y[k];
+        positions[k * 3 + 2] = zmin;
+
+        positions[12 + k * 3 + 0] = x[k];
+        positions[12 + k * 3 + 1] = y[k];
+        positions[12 + k * 3 + 2] = zmax;
+    }
+
+    for (uint32_t i = 0; i < RECTANGLE_INDICES; i++)
+        indices[i] = g_rectangle_indices[i] + first_index;
+}
+
+#if defined(__wasm_simd128__)
+
+// Corners (x, y) of one rectangle to its 4 vertices at z: [x0 y0 z x1] [y1 z x2 y2] [z x3 y3 z]
+static inline void storeRectangleFace(v128_t x, v128_t y, v128_t z, float *positions)
+{
+    const v128_t lo = wasm_i32x4_shuffle(x, y, 0, 4, 1, 5);
+    const v128_t hi = wasm_i32x4_shuffle(x, y, 2, 6, 3, 7);
+
+    wasm_v128_store(positions + 0, wasm_i32x4_shuffle(lo, z, 0, 1, 4, 2));
+    wasm_v128_store(positions + 4, wasm_i32x4_shuffle(lo, wasm_i32x4_shuffle(hi, z, 4, 0, 1, 4), 3, 4, 5, 6));
+    wasm_v128_store(positions + 8, wasm_i32x4_shuffle(hi, z, 4, 2, 3, 4));
+}
+
+// 4x4 transpose: from corner k of 4 rectangles to the 4 corners of rectangle r
+static inline void transpose4(v128_t &c0, v128_t &c1, v128_t &c2, v128_t &c3)
+{
+    const v128_t t0 = wasm_i32x4_shuffle(c0, c1, 0, 4, 1, 5);
+    const v128_t t1 = wasm_i32x4_shuffle(c2, c3, 0, 4, 1, 5);
+    const v128_t t2 = wasm_i32x4_shuffle(c0, c1, 2, 6, 3, 7);
+    const v128_t t3 = wasm_i32x4_shuffle(c2, c3, 2, 6, 3, 7);
+    c0 = wasm_i64x2_shuffle(t0, t1, 0, 2);
+    c1 = wasm_i64x2_shuffle(t0, t1, 1, 3);
+    c2 = wasm_i64x2_shuffle(t2, t3, 0, 2);
+    c3 = wasm_i64x2_shuffle(t2, t3, 1, 3);
+}
+
+static uint64_t extrudeRectanglesSimd(const rectangles_batch &rectangles, float zmin, float zmax, uint32_t first_index, float *positions, uint32_t *indices)
+{
+    const uint64_t count = rectangles.size() & ~(uint64_t)3;
+    const v128_t zmin_v = wasm_f32x4_splat(zmin);
+    const v128_t zmax_v = wasm_f32x4_splat(zmax);
+
+    v128_t pattern[RECTANGLE_INDICES / 4];
+    for (uint32_t i = 0; i < RECTANGLE_INDICES / 4; i++)
+        pattern[i] = wasm_v128_load(g_rectangle_indices + i * 4);
+
+    for (uint64_t r = 0; r < count; r += 4)
+    {
+        v128_t x[4], y[4];
+        for (int k = 0; k < 4; k++)
+        {
+            x[k] = wasm_v128_load(rectangles.x[k].data() + r);
+            y[k] = wasm_v128_load(rectangles.y[k].data() + r);
+        }
+        transpose4(x[0], x[1], x[2], x[3]);
+        transpose4(y[0], y[1], y[2], y[3]);
+
+        for (int j = 0; j < 4; j++)
+        {
+            float *rectangle_positions = positions + (r + j) * RECTANGLE_VERTICES * 3;
+            storeRectangleFace(x[j], y[j], zmin_v, rectangle_positions);
+            storeRectangleFace(x[j], y[j], zmax_v, rectangle_positions + 12);
+
+            const v128_t base = wasm_i32x4_splat(first_index + (uint32_t)(r + j) * RECTANGLE_VERTICES);
+            uint32_t *rectangle_indices = indices + (r + j) * RECTANGLE_INDICES;
+            for (uint32_t i = 0; i < RECTANGLE_INDICES / 4; i++)
+                wasm_v128_store(rectangle_indices + i * 4, wasm_i32x4_add(pattern[i], base));
+        }
+    }
+
+    return count;
+}
+
+#elif defined(__SSE2__)
+
+// Corners (x, y) of one rectangle to its 4 vertices at z: [x0 y0 z x1] [y1 z x2 y2] [z x3 y3 z]
+static inline void storeRectangleFace(__m128 x, __m128 y, __m128 z, float *positions)
+{
+    const __m128 lo = _mm_unpacklo_ps(x, y); // x0 y0 x1 y1
+    const __m128 hi = _mm_unpackhi_ps(x, y); // x2 y2 x3 y3
+
+    const __m128 z_x1 = _mm_shuffle_ps(z, lo, _MM_SHUFFLE(2, 2, 0, 0));
+    const __m128 y1_z = _mm_shuffle_ps(lo, z, _MM_SHUFFLE(0, 0, 3, 3));
+    const __m128 z_x3y3 = _mm_shuffle_ps(z, hi, _MM_SHUFFLE(3, 2, 0, 0));
+
+    _mm_storeu_ps(positions + 0, _mm_shuffle_ps(lo, z_x1, _MM_SHUFFLE(2, 0, 1, 0)));
+    _mm_storeu_ps(positions + 4, _mm_shuffle_ps(y1_z, hi, _MM_SHUFFLE(1, 0, 2, 0)));
+    _mm_storeu_ps(positions + 8, _mm_shuffle_ps(z_x3y3, z_x3y3, _MM_SHUFFLE(0, 3, 2, 0)));
+}
+
+static uint64_t extrudeRectanglesSimd(const rectangles_batch &rectangles, float zmin, float zmax, uint32_t first_index, float *positions, uint32_t *indices)
+{
+    const uint64_t count = rectangles.size() & ~(uint64_t)3;
+    const __m128 zmin_v = _mm_set1_ps(zmin);
+    const __m128 zmax_v = _mm_set1_ps(zmax);
+
+    __m128i pattern[RECTANGLE_INDICES / 4];
+    for (uint32_t i = 0; i < RECTANGLE_INDICES / 4; i++)
+        pattern[i] = _mm_load_si128((const __m128i *)(g_rectangle_indices + i * 4));
+
+    for (uint64_t r = 0; r < count; r += 4)
+    {
+        __m128 x[4], y[4];
+        for (int k = 0; k < 4; k++)
+        {
+            x[k] = _mm_loadu_ps(rectangles.x[k].data() + r);
+            y[k] = _mm_loadu_ps(rectangles.y[k].data() + r);
+        }
+        // From corner k of 4 rectangles to the 4 corners of rectangle r
+        _MM_TRANSPOSE4_PS(x[0], x[1], x[2], x[3]);
+        _MM_TRANSPOSE4_PS(y[0], y[1], y[2], y[3]);
+
+        for (int j = 0; j < 4; j++)
+        {
+            float *rectangle_positions = positions + (r + j) * RECTANGLE_VERTICES * 3;
+            storeRectangleFace(x[j], y[j], zmin_v, rectangle_positions);
+            storeRectangleFace(x[j], y[j], zmax_v, rectangle_positions + 12);
+
+            const __m128i base = _mm_set1_epi32(first_index + (uint32_t)(r + j) * RECTANGLE_VERTICES);
+            uint32_t *rectangle_indices = indices + (r + j) * RECTANGLE_INDICES;
+            for (uint32_t i = 0; i < RECTANGLE_INDICES / 4; i++)
+                _mm_storeu_si128((__m128i *)(rectangle_indices + i * 4), _mm_add_epi32(pattern[i], base));
+        }
+    }
+
+    return count;
+}
+
+#else
+
+static uint64_t extrudeRectanglesSimd(const rectangles_batch &rectangles, float zmin, float zmax, uint32_t first_index, float *positions, uint32_t *indices)
+{
+    return 0;
+}
+
+#endif
+
+void extrudeRectangles(const rectangles_batch &rectangles, float zmin, float zmax, uint32_t first_index, float *positions, uint32_t *indices)
+{
+    // Groups of 4 rectangles with SIMD, the rest one by one
+    const uint64_t simd_count = extrudeRectanglesSimd(rectangles, zmin, zmax, first_index, positions, indices);
+
+    for (uint64_t r = simd_count; r < rectangles.size(); r++)
+    {
+        const float x[4] = {rectangles.x[0][r], rectangles.x[1][r], rectangles.x[2][r], rectangles.x[3][r]};
+        const float y[4] = {rectangles.y[0][r], rectangles.y[1][r], rectangles.y[2][r], rectangles.y[3][r]};
+        extrudeRectangle(x, y, zmin, zmax, first_index + (uint32_t)r * RECTANGLE_VERTICES, positions + r * RECTANGLE_VERTICES * 3, indices + r * RECTANGLE_INDICES);
+    }
+}
+
+uint32_t extrudeRectangleFaces(const float x[4], const float y[4], float zmin, float zmax, uint32_t first_index, uint32_t hidden_faces, float *positions, uint32_t *indices)
+{
+    uint32_t all_indices[RECTANGLE_INDICES];
+    extrudeRectangle(x, y, zmin, zmax, first_index, positions, all_indices);
+
+    // g_rectangle_indices has 2 triangles per face, in the RECTANGLE_FACE_* bits order
+    uint32_t indices_count = 0;
+    for (uint32_t face = 0; face < RECTANGLE_INDICES / 6; face++)
+    {
+        if (hidden_faces & (1u << face))
+            continue;
+        for (uint32_t i = 0; i < 6; i++)
+            indices[indices_count++] = all_indices[face * 6 + i];
+    }
+    return indices_count;
+}
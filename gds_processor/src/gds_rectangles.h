@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// Axis-aligned rectangles of one layer, stored as a structure of arrays so they can be extruded 4 at a time.
+// Corner k of rectangle r is (x[k][r], y[k][r]), in the order of the polygon points (it decides the faces winding)
+struct rectangles_batch
+{
+    std::vector<float> x[4];
+    std::vector<float> y[4];
+
+    uint64_t size() const
+    {
+        return x[0].size();
+    }
+
+    void clear()
+    {
+        for (int k = 0; k < 4; k++)
+        {
+            x[k].clear();
+            y[k].clear();
+        }
+    }
+
+    void add(const float corners_x[4], const float corners_y[4])
+    {
+        for (int k = 0; k < 4; k++)
+        {
+            x[k].push_back(corners_x[k]);
+            y[k].push_back(corners_y[k]);
+        }
+    }
+};
+
+// Vertices and indices each extruded rectangle takes
+constexpr uint32_t RECTANGLE_VERTICES = 8;
+constexpr uint32_t RECTANGLE_INDICES = 36;
+
+// Writes the extruded boxes of the batch: 8 vertices (bottom corners at zmin, then top corners at zmax) and 12 triangles per rectangle.
+// The corners and z values are only copied (SIMD shuffles), so quantized int32 positions stored in the floats go through unchanged.
+// positions needs room for size() * RECTANGLE_VERTICES * 3 floats and indices for size() * RECTANGLE_INDICES.
+// first_index is the index of the first vertex written
+void extrudeRectangles(const rectangles_batch &rectangles, float zmin, float zmax, uint32_t first_index, float *positions, uint32_t *indices);
+
+// Faces of an extruded rectangle, for extrudeRectangleFaces. Side k is the wall of the edge from corner k to corner k + 1
+enum : uint32_t
+{
+    RECTANGLE_FACE_BOTTOM = 1,
+    RECTANGLE_FACE_TOP = 2,
+    RECTANGLE_FACE_SIDE0 = 4
+};
+
+// One rectangle without the hidden_faces (RECTANGLE_FACE_* flags). Writes the 8 vertices and the indices of the other faces
+// (room for RECTANGLE_INDICES), returns the number of indices written
+uint32_t extrudeRectangleFaces(const float x[4], const float y[4], float zmin, float zmax, uint32_t first_index, uint32_t hidden_faces, float *positions, uint32_t *indices);
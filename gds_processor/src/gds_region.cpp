@@ -0,0 +1,129 @@
+#include <math.h>
+#include <algorithm>
+#include "gds_region.h"
+
+using namespace gdstk;
+
+void placements_index::build()
+{
+    columns = rows = 0;
+    if (placements.empty())
+        return;
+
+    Vec2 max = placements[0].max;
+    min = placements[0].min;
+    for (const placement &p : placements)
+    {
+        min.x = std::min(min.x, p.min.x);
+        min.y = std::min(min.y, p.min.y);
+        max.x = std::max(max.x, p.max.x);
+        max.y = std::max(max.y, p.max.y);
+    }
+
+    const uint32_t side = std::min((uint32_t)ceil(sqrt((double)placements.size())), MAX_GRID_SIDE);
+    columns = rows = std::max(side, 1u);
+    cell_size.x = (max.x - min.x) / columns;
+    cell_size.y = (max.y - min.y) / rows;
+    if (cell_size.x <= 0 || cell_size.y <= 0)
+    {
+        columns = rows = 1;
+        cell_size.x = std::max(max.x - min.x, 1.0);
+        cell_size.y = std::max(max.y - min.y, 1.0);
+    }
+
+    // Counting sort of the placements by grid cell (a placement goes to every cell it overlaps), like buildCellShapesIndex
+    auto forEachCell = [&](const placement &p, auto visit)
+    {
+        const uint32_t column_begin = std::min((uint32_t)((p.min.x - min.x) / cell_size.x), columns - 1);
+        const uint32_t column_end = std::min((uint32_t)((p.max.x - min.x) / cell_size.x), columns - 1);
+        const uint32_t row_begin = std::min((uint32_t)((p.min.y - min.y) / cell_size.y), rows - 1);
+        const uint32_t row_end = std::min((uint32_t)((p.max.y - min.y) / cell_size.y), rows - 1);
+        for (uint32_t row = row_begin; row <= row_end; row++)
+            for (uint32_t column = column_begin; column <= column_end; column++)
+                visit(row * columns + column);
+    };
+
+    const uint32_t cells_count = columns * rows;
+    grid_begin.assign(cells_count + 2, 0);
+    for (const placement &p : placements)
+        forEachCell(p, [&](uint32_t c)
+                    { grid_begin[c + 2]++; });
+    for (uint32_t c = 2; c < cells_count + 2; c++)
+        grid_begin[c] += grid_begin[c - 1];
+    grid_placements.resize(grid_begin[cells_count + 1]);
+    for (uint32_t i = 0; i < placements.size(); i++)
+        forEachCell(placements[i], [&](uint32_t c)
+                    { grid_placements[grid_begin[c + 1]++] = i; });
+
+    query_stamps.assign(placements.size(), 0);
+    query_stamp = 0;
+}
+
+void placements_index::query(const Vec2 &box_min, const Vec2 &box_max, std::vector<uint32_t> &result)
+{
+    if (columns == 0)
+        return;
+
+    // Grid cells range of the query, clamped to the grid
+    const double column_min = floor((box_min.x - min.x) / cell_size.x);
+    const double column_max = floor((box_max.x - min.x) / cell_size.x);
+    const double row_min = floor((box_min.y - min.y) / cell_size.y);
+    const double row_max = floor((box_max.y - min.y) / cell_size.y);
+    if (column_max < 0 || row_max < 0 || column_min >= columns || row_min >= rows)
+        return;
+
+    const uint32_t column_begin = (uint32_t)std::max(column_min, 0.0);
+    const uint32_t column_end = (uint32_t)std::min(column_max, columns - 1.0);
+    const uint32_t row_begin = (uint32_t)std::max(row_min, 0.0);
+    const uint32_t row_end = (uint32_t)std::min(row_max, rows - 1.0);
+
+    if (++query_stamp == 0)
+    {
+        std::fill(query_stamps.begin(), query_stamps.end(), 0);
+        query_stamp = 1;
+    }
+
+    for (uint32_t row = row_begin; row <= row_end; row++)
+    {
+        for (uint32_t column = column_begin; column <= column_end; column++)
+        {
+            const uint32_t c = row * columns + column;
+            for (uint32_t i = grid_begin[c]; i < grid_begin[c + 1]; i++)
+            {
+                const uint32_t placement_idx = grid_placements[i];
+                if (query_stamps[placement_idx] == query_stamp)
+                    continue;
+                query_stamps[placement_idx] = query_stamp;
+
+                const placement &p = placements[placement_idx];
+                if (p.min.x <= box_max.x && p.max.x >= box_min.x && p.min.y <= box_max.y && p.max.y >= box_min.y)
+                    result.push_back(placement_idx);
+            }
+        }
+    }
+}
+
+void referenceBoundingBox(const Reference *reference, const Vec2 &offset, const Vec2 &cell_min, const Vec2 &cell_max, Vec2 &box_min, Vec2 &box_max)
+{
+    // Same order as gdstk: magnification and x_reflection, then rotation, then translation
+    const double ca = cos(reference->rotation) * reference->magnification;
+    const double sa = sin(reference->rotation) * reference->magnification;
+    const double reflection = reference->x_reflection ? -1 : 1;
+    const Vec2 corners[4] = {cell_min, {cell_max.x, cell_min.y}, cell_max, {cell_min.x, cell_max.y}};
+
+    for (int k = 0; k < 4; k++)
+    {
+        const double x = corners[k].x;
+        const double y = corners[k].y * reflection;
+        const Vec2 point = {reference->origin.x + offset.x + x * ca - y * sa, reference->origin.y + offset.y + x * sa + y * ca};
+        if (k == 0)
+        {
+            box_min = box_max = point;
+            continue;
+        }
+        box_min.x = std::min(box_min.x, point.x);
+        box_min.y = std::min(box_min.y, point.y);
+        box_max.x = std::max(box_max.x, point.x);
+        box_max.y = std::max(box_max.y, point.y);
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <gdstk/gdstk.hpp>
+
+// Placements of the references of the top cell (one per repetition offset), with their bounding boxes in top cell
+// coordinates, to find the ones under a rectangle (see processRegion).
+// Usage: add every placement, build, then query
+struct placements_index
+{
+    struct placement
+    {
+        uint64_t cell_idx;
+        gdstk::Vec2 min;
+        gdstk::Vec2 max;
+    };
+
+    // Uniform grid over the placements: placements of grid cell c are grid_placements[grid_begin[c] .. grid_begin[c + 1])
+    static constexpr uint32_t MAX_GRID_SIDE = 256;
+
+    std::vector<placement> placements;
+    gdstk::Vec2 min = {};
+    gdstk::Vec2 cell_size = {};
+    uint32_t columns = 0;
+    uint32_t rows = 0;
+    std::vector<uint32_t> grid_begin;
+    std::vector<uint32_t> grid_placements;
+    // A placement spanning several grid cells is reported once per query
+    std::vector<uint32_t> query_stamps;
+    uint32_t query_stamp = 0;
+
+    void clear()
+    {
+        placements.clear();
+        columns = rows = 0;
+    }
+    void add(uint64_t cell_idx, const gdstk::Vec2 &box_min, const gdstk::Vec2 &box_max)
+    {
+        placements.push_back({cell_idx, box_min, box_max});
+    }
+    void build();
+    // Appends to result the placements (indexes of placements) whose bounding box intersects [box_min, box_max]
+    void query(const gdstk::Vec2 &box_min, const gdstk::Vec2 &box_max, std::vector<uint32_t> &result);
+};
+
+// Bounding box in the parent cell coordinates of the reference placed at offset (one of its repetition offsets),
+// cell_min and cell_max being the bounding box of the referenced cell
+void referenceBoundingBox(const gdstk::Reference *reference, const gdstk::Vec2 &offset, const gdstk::Vec2 &cell_min, const gdstk::Vec2 &cell_max, gdstk::Vec2 &box_min, gdstk::Vec2 &box_max);
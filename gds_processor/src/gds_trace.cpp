@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "gds_trace.h"
+
+bool g_trace_enabled = false;
+
+static const char *g_trace_stage_names[TRACE_STAGES_COUNT] = {
+    "parse",
+    "bounding_boxes",
+    "references",
+    "aliases",
+    "polygons",
+    "merge",
+    "culling",
+    "triangulation",
+    "extrusion",
+    "lods",
+    "packing",
+    "transfer",
+};
+
+static const char *g_trace_counter_names[TRACE_COUNTERS_COUNT] = {
+    "polygons",
+    "triangulated_polygons",
+    "rectilinear_polygons",
+    "triangles",
+    "transfers",
+    "transferred_bytes",
+};
+
+// Events kept per thread, the next ones only count in the totals
+static constexpr uint64_t MAX_TRACE_EVENTS = 1 << 20;
+
+struct trace_event
+{
+    uint64_t begin;
+    uint64_t end;
+    trace_stage stage;
+};
+
+struct trace_buffer
+{
+    uint32_t tid = 0;
+    std::vector<trace_event> events;
+    uint64_t dropped_events = 0;
+    uint64_t stage_calls[TRACE_STAGES_COUNT] = {};
+    uint64_t stage_time[TRACE_STAGES_COUNT] = {};
+    uint64_t stage_max_time[TRACE_STAGES_COUNT] = {};
+    uint64_t counters[TRACE_COUNTERS_COUNT] = {};
+
+    void clear()
+    {
+        events.clear();
+        dropped_events = 0;
+        std::fill(stage_calls, stage_calls + TRACE_STAGES_COUNT, 0);
+        std::fill(stage_time, stage_time + TRACE_STAGES_COUNT, 0);
+        std::fill(stage_max_time, stage_max_time + TRACE_STAGES_COUNT, 0);
+        std::fill(counters, counters + TRACE_COUNTERS_COUNT, 0);
+    }
+};
+
+// One buffer per thread that recorded something, with its own tid (one row in the trace viewer)
+// runJobs keeps its worker threads, so the buffers and their tids stay the same from one batch to the next
+static std::mutex g_trace_mutex;
+static std::vector<std::unique_ptr<trace_buffer>> g_trace_buffers;
+static std::chrono::steady_clock::time_point g_trace_origin = std::chrono::steady_clock::now();
+static thread_local trace_buffer *t_trace_buffer = NULL;
+
+static trace_buffer &threadBuffer()
+{
+    if (t_trace_buffer != NULL)
+        return *t_trace_buffer;
+
+    std::lock_guard<std::mutex> lock(g_trace_mutex);
+    g_trace_buffers.emplace_back(new trace_buffer());
+    t_trace_buffer = g_trace_buffers.back().get();
+    t_trace_buffer->tid = (uint32_t)g_trace_buffers.size() - 1;
+    return *t_trace_buffer;
+}
+
+const char *traceStageName(trace_stage stage)
+{
+    return stage < TRACE_STAGES_COUNT ? g_trace_stage_names[stage] : "?";
+}
+
+const char *traceCounterName(trace_counter counter)
+{
+    return counter < TRACE_COUNTERS_COUNT ? g_trace_counter_names[counter] : "?";
+}
+
+uint64_t traceNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - g_trace_origin).count();
+}
+
+void traceRecord(trace_stage stage, uint64_t begin, uint64_t end)
+{
+    trace_buffer &buffer = threadBuffer();
+    const uint64_t time = end - begin;
+    buffer.stage_calls[stage]++;
+    buffer.stage_time[stage] += time;
+    buffer.stage_max_time[stage] = std::max(buffer.stage_max_time[stage], time);
+
+    if (buffer.events.size() < MAX_TRACE_EVENTS)
+        buffer.events.push_back({begin, end, stage});
+    else
+        buffer.dropped_events++;
+}
+
+void traceAdd(trace_counter counter, uint64_t value)
+{
+    threadBuffer().counters[counter] += value;
+}
+
+void traceReset()
+{
+    std::lock_guard<std::mutex> lock(g_trace_mutex);
+    for (auto &buffer : g_trace_buffers)
+        buffer->clear();
+    g_trace_origin = std::chrono::steady_clock::now();
+}
+
+trace_summary traceSummary()
+{
+    std::lock_guard<std::mutex> lock(g_trace_mutex);
+    trace_summary summary = {};
+    for (const auto &buffer : g_trace_buffers)
+    {
+        if (buffer->events.empty() && buffer->dropped_events == 0)
+            continue;
+
+        summary.threads++;
+        summary.events += buffer->events.size();
+        summary.dropped_events += buffer->dropped_events;
+        for (uint32_t s = 0; s < TRACE_STAGES_COUNT; s++)
+        {
+            summary.stages[s].calls += buffer->stage_calls[s];
+            summary.stages[s].total_ms += buffer->stage_time[s] / 1e6;
+            summary.stages[s].max_ms = std::max(summary.stages[s].max_ms, buffer->stage_max_time[s] / 1e6);
+        }
+        for (uint32_t c = 0; c < TRACE_COUNTERS_COUNT; c++)
+            summary.counters[c] += buffer->counters[c];
+    }
+    return summary;
+}
+
+void tracePrintSummary(void (*print)(const char *format, ...))
+{
+    const trace_summary summary = traceSummary();
+    print("Trace summary: %u threads, %" PRIu64 " events (%" PRIu64 " not kept)\n", summary.threads, summary.events, summary.dropped_events);
+    print("\t%-16s %10s %12s %12s %12s\n", "stage", "calls", "total ms", "avg us", "max ms");
+    for (uint32_t s = 0; s < TRACE_STAGES_COUNT; s++)
+    {
+        const trace_summary::stage_totals &stage = summary.stages[s];
+        if (stage.calls == 0)
+            continue;
+        print("\t%-16s %10" PRIu64 " %12.3f %12.3f %12.3f\n", traceStageName((trace_stage)s), stage.calls, stage.total_ms, stage.total_ms * 1000 / stage.calls, stage.max_ms);
+    }
+    for (uint32_t c = 0; c < TRACE_COUNTERS_COUNT; c++)
+        print("\t%-24s %" PRIu64 "\n", traceCounterName((trace_counter)c), summary.counters[c]);
+}
+
+bool traceWrite(const char *filepath)
+{
+    FILE *file = fopen(filepath, "w");
+    if (file == NULL)
+        return false;
+
+    std::lock_guard<std::mutex> lock(g_trace_mutex);
+    // Complete events ("X"), ts and dur in microseconds
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (const auto &buffer : g_trace_buffers)
+    {
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s %u\"}}", first ? "" : ",\n", buffer->tid, buffer->tid == 0 ? "main" : "worker", buffer->tid);
+        first = false;
+
+        for (const trace_event &event : buffer->events)
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", traceStageName(event.stage), buffer->tid, event.begin / 1e3, (event.end - event.begin) / 1e3);
+    }
+
+    // Counters of all the threads, as one sample at the end of the trace
+    uint64_t counters[TRACE_COUNTERS_COUNT] = {};
+    uint64_t last_end = 0;
+    for (const auto &buffer : g_trace_buffers)
+    {
+        for (uint32_t c = 0; c < TRACE_COUNTERS_COUNT; c++)
+            counters[c] += buffer->counters[c];
+        if (!buffer->events.empty())
+            last_end = std::max(last_end, buffer->events.back().end);
+    }
+    for (uint32_t c = 0; c < TRACE_COUNTERS_COUNT; c++)
+        fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":0,\"ts\":%.3f,\"args\":{\"value\":%" PRIu64 "}}", first && c == 0 ? "" : ",\n", traceCounterName((trace_counter)c), last_end / 1e3, counters[c]);
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return true;
+}
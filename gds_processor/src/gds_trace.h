@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+
+// Scoped timers and counters of the processing stages (trace process option).
+// Each thread records in its own buffer, so nothing is locked while processing. With the option off a scope only checks
+// g_trace_enabled. The events can be written as Chrome trace events JSON (chrome://tracing, ui.perfetto.dev) and are
+// summed per stage for a summary table
+enum trace_stage : uint32_t
+{
+    TRACE_PARSE,
+    TRACE_BOUNDING_BOXES,
+    TRACE_REFERENCES,
+    // Hashing and comparison of the cells shapes (alias_identical_cells)
+    TRACE_ALIASES,
+    // Shapes index of the cell and polygons of each layer (getCellLayerPolygons)
+    TRACE_POLYGONS,
+    TRACE_MERGE,
+    TRACE_CULLING,
+    // 2D triangulation of the polygons that aren't rectangles (rectilinear boxes or CDT)
+    TRACE_TRIANGULATION,
+    // Extruded triangles or lines, and shared vertices
+    TRACE_EXTRUSION,
+    TRACE_LODS,
+    // Packing of the meshes and labels blobs
+    TRACE_PACKING,
+    // Blobs handed to the output sink (JS_gds_add_cell_meshes, JS_gds_add_cell_labels, JS_gds_add_references)
+    TRACE_TRANSFER,
+    TRACE_STAGES_COUNT
+};
+
+enum trace_counter : uint32_t
+{
+    TRACE_COUNTER_POLYGONS,
+    TRACE_COUNTER_TRIANGULATED_POLYGONS,
+    // Triangulated polygons split in boxes instead of going through CDT
+    TRACE_COUNTER_RECTILINEAR_POLYGONS,
+    TRACE_COUNTER_TRIANGLES,
+    TRACE_COUNTER_TRANSFERS,
+    TRACE_COUNTER_TRANSFERRED_BYTES,
+    TRACE_COUNTERS_COUNT
+};
+
+extern bool g_trace_enabled;
+
+const char *traceStageName(trace_stage stage);
+const char *traceCounterName(trace_counter counter);
+
+// Nanoseconds since the last traceReset
+uint64_t traceNow();
+void traceRecord(trace_stage stage, uint64_t begin, uint64_t end);
+void traceAdd(trace_counter counter, uint64_t value);
+
+inline void traceCount(trace_counter counter, uint64_t value)
+{
+    if (g_trace_enabled)
+        traceAdd(counter, value);
+}
+
+// Times its lifetime as one event of stage
+struct trace_scope
+{
+    trace_stage stage;
+    bool active;
+    uint64_t begin;
+
+    trace_scope(trace_stage stage) : stage(stage), active(g_trace_enabled), begin(active ? traceNow() : 0) {}
+    ~trace_scope()
+    {
+        if (active)
+            traceRecord(stage, begin, traceNow());
+    }
+    trace_scope(const trace_scope &) = delete;
+    trace_scope &operator=(const trace_scope &) = delete;
+};
+
+// Totals of all the threads. Stages don't nest, so their times add up
+struct trace_summary
+{
+    struct stage_totals
+    {
+        uint64_t calls;
+        double total_ms;
+        double max_ms;
+    };
+
+    stage_totals stages[TRACE_STAGES_COUNT];
+    uint64_t counters[TRACE_COUNTERS_COUNT];
+    uint64_t events;
+    // Events over the per thread limit are only added to the totals
+    uint64_t dropped_events;
+    uint32_t threads;
+};
+
+// The functions below must be called while no processing runs
+// Drops the recorded events and counters, and restarts the clock
+void traceReset();
+trace_summary traceSummary();
+// Prints the summary as a table, one print call per line (e.g. with JS_gds_info_log)
+void tracePrintSummary(void (*print)(const char *format, ...));
+// Writes the events as Chrome trace events JSON. Returns false if the file can't be written
+bool traceWrite(const char *filepath);
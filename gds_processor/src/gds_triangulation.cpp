@@ -0,0 +1,518 @@
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <CDT.h>
+#include "gds_triangulation.h"
+
+using namespace gdstk;
+
+// Vertical edge of a rectilinear polygon, winding 1 going up and -1 going down
+struct rectilinear_edge
+{
+    double x;
+    double y_min;
+    double y_max;
+    int winding;
+};
+
+struct rectilinear_box
+{
+    double x0;
+    double x1;
+    double y0;
+    double y1;
+};
+
+// Box corner or polygon point, sorted by (y, x)
+struct rectilinear_corner
+{
+    double y;
+    double x;
+    uint32_t vertex;
+
+    bool operator<(const rectilinear_corner &other) const
+    {
+        return y < other.y || (y == other.y && x < other.x);
+    }
+};
+
+static bool isRectilinear(const Polygon *poly)
+{
+    const uint64_t points_count = poly->point_array.count;
+    if (points_count < 4)
+        return false;
+    for (uint64_t k = 0; k < points_count; k++)
+    {
+        const Vec2 &p = poly->point_array[k];
+        const Vec2 &q = poly->point_array[k + 1 < points_count ? k + 1 : 0];
+        if (p.x != q.x && p.y != q.y)
+            return false;
+    }
+    return true;
+}
+
+// Splits a rectilinear polygon in boxes with a sweep line going up. Between two consecutive y of the points, the vertical
+// edges crossing the slab give the filled intervals (nonzero rule), and a box grows while its interval stays the same
+static void decomposeRectilinear(const Polygon *poly, std::vector<rectilinear_box> &boxes)
+{
+    thread_local std::vector<rectilinear_edge> edges;
+    thread_local std::vector<rectilinear_edge> active;
+    thread_local std::vector<double> ys;
+    thread_local std::vector<std::pair<double, double>> intervals;
+    thread_local std::vector<rectilinear_box> open;
+    thread_local std::vector<rectilinear_box> next_open;
+    edges.clear();
+    active.clear();
+    ys.clear();
+    open.clear();
+    boxes.clear();
+
+    const uint64_t points_count = poly->point_array.count;
+    for (uint64_t k = 0; k < points_count; k++)
+    {
+        const Vec2 &p = poly->point_array[k];
+        const Vec2 &q = poly->point_array[k + 1 < points_count ? k + 1 : 0];
+        ys.push_back(p.y);
+        if (p.x == q.x && p.y != q.y)
+            edges.push_back({p.x, std::min(p.y, q.y), std::max(p.y, q.y), q.y > p.y ? 1 : -1});
+    }
+    std::sort(edges.begin(), edges.end(), [](const rectilinear_edge &a, const rectilinear_edge &b)
+              { return a.y_min < b.y_min; });
+    std::sort(ys.begin(), ys.end());
+    ys.erase(std::unique(ys.begin(), ys.end()), ys.end());
+
+    uint64_t next_edge = 0;
+    for (uint64_t s = 0; s + 1 < ys.size(); s++)
+    {
+        const double y = ys[s];
+
+        // Active edges cross [y, ys[s + 1]], sorted by x
+        active.erase(std::remove_if(active.begin(), active.end(), [y](const rectilinear_edge &edge)
+                                    { return edge.y_max <= y; }),
+                     active.end());
+        for (; next_edge < edges.size() && edges[next_edge].y_min <= y; next_edge++)
+        {
+            auto position = std::upper_bound(active.begin(), active.end(), edges[next_edge].x, [](double x, const rectilinear_edge &edge)
+                                             { return x < edge.x; });
+            active.insert(position, edges[next_edge]);
+        }
+
+        // Edges at the same x are added together, so the opposite edges of a hole cut to the outline cancel
+        intervals.clear();
+        int winding = 0;
+        double interval_begin = 0;
+        for (uint64_t i = 0; i < active.size();)
+        {
+            const double x = active[i].x;
+            int next_winding = winding;
+            for (; i < active.size() && active[i].x == x; i++)
+                next_winding += active[i].winding;
+
+            if (winding == 0 && next_winding != 0)
+                interval_begin = x;
+            else if (winding != 0 && next_winding == 0)
+                intervals.push_back({interval_begin, x});
+            winding = next_winding;
+        }
+
+        // Open boxes and intervals are both sorted and disjoint
+        next_open.clear();
+        uint64_t o = 0;
+        uint64_t v = 0;
+        while (o < open.size() || v < intervals.size())
+        {
+            if (v == intervals.size() || (o < open.size() && open[o].x0 < intervals[v].first))
+            {
+                boxes.push_back({open[o].x0, open[o].x1, open[o].y0, y});
+                o++;
+            }
+            else if (o == open.size() || intervals[v].first < open[o].x0)
+            {
+                next_open.push_back({intervals[v].first, intervals[v].second, y, 0});
+                v++;
+            }
+            else
+            {
+                if (open[o].x1 == intervals[v].second)
+                {
+                    next_open.push_back(open[o]);
+                }
+                else
+                {
+                    boxes.push_back({open[o].x0, open[o].x1, open[o].y0, y});
+                    next_open.push_back({intervals[v].first, intervals[v].second, y, 0});
+                }
+                o++;
+                v++;
+            }
+        }
+        open.swap(next_open);
+    }
+
+    for (const rectilinear_box &box : open)
+        boxes.push_back({box.x0, box.x1, box.y0, ys.back()});
+}
+
+bool layer_triangulation::add(const Polygon *poly)
+{
+    if (isRectilinear(poly))
+    {
+        addRectilinear(poly);
+        return true;
+    }
+    addConstrained(poly);
+    return false;
+}
+
+// The boxes are triangulated as strips between the corners along their bottom and their top side, including the corners
+// of the boxes next to them, so the faces have no T-junctions between boxes. The corners that fall in the middle of a
+// polygon edge go in the outline, where the side wall of that edge is split, so there are none between walls and faces either
+void layer_triangulation::addRectilinear(const Polygon *poly)
+{
+    thread_local std::vector<rectilinear_box> boxes;
+    thread_local std::vector<rectilinear_corner> corners;
+    thread_local std::vector<rectilinear_corner> corners_by_x;
+    thread_local std::vector<rectilinear_corner> points;
+    decomposeRectilinear(poly, boxes);
+
+    const uint64_t points_count = poly->point_array.count;
+    polygon result = {};
+    result.points_count = points_count;
+    result.first_point = poly->point_array[0];
+    result.vertices_begin = (uint32_t)vertices.size();
+    result.triangles_begin = (uint32_t)triangles.size();
+    result.mapping_begin = NO_MAPPING;
+    result.outline_begin = NO_OUTLINE;
+
+    // The polygon points are the first vertices, the extruded side walls use them
+    for (uint64_t k = 0; k < points_count; k++)
+        vertices.push_back(poly->point_array[k]);
+
+    corners.clear();
+    for (const rectilinear_box &box : boxes)
+    {
+        corners.push_back({box.y0, box.x0, 0});
+        corners.push_back({box.y0, box.x1, 0});
+        corners.push_back({box.y1, box.x0, 0});
+        corners.push_back({box.y1, box.x1, 0});
+    }
+    std::sort(corners.begin(), corners.end());
+    corners.erase(std::unique(corners.begin(), corners.end(), [](const rectilinear_corner &a, const rectilinear_corner &b)
+                              { return a.y == b.y && a.x == b.x; }),
+                  corners.end());
+
+    // Corners on a polygon point use its vertex
+    points.clear();
+    for (uint64_t k = 0; k < points_count; k++)
+        points.push_back({poly->point_array[k].y, poly->point_array[k].x, (uint32_t)k});
+    std::stable_sort(points.begin(), points.end());
+
+    uint64_t p = 0;
+    for (rectilinear_corner &corner : corners)
+    {
+        while (p < points.size() && points[p] < corner)
+            p++;
+        if (p < points.size() && !(corner < points[p]))
+        {
+            corner.vertex = points[p].vertex;
+        }
+        else
+        {
+            corner.vertex = (uint32_t)(vertices.size() - result.vertices_begin);
+            vertices.push_back({corner.x, corner.y});
+        }
+    }
+
+    for (const rectilinear_box &box : boxes)
+    {
+        const rectilinear_corner *bottom = &*std::lower_bound(corners.begin(), corners.end(), rectilinear_corner{box.y0, box.x0, 0});
+        const uint64_t bottom_count = std::upper_bound(corners.begin(), corners.end(), rectilinear_corner{box.y0, box.x1, 0}) - corners.begin() - (bottom - corners.data());
+        const rectilinear_corner *top = &*std::lower_bound(corners.begin(), corners.end(), rectilinear_corner{box.y1, box.x0, 0});
+        const uint64_t top_count = std::upper_bound(corners.begin(), corners.end(), rectilinear_corner{box.y1, box.x1, 0}) - corners.begin() - (top - corners.data());
+
+        // Counterclockwise triangles, like the CDT ones
+        uint64_t i = 0;
+        uint64_t j = 0;
+        while (i + 1 < bottom_count || j + 1 < top_count)
+        {
+            if (j + 1 == top_count || (i + 1 < bottom_count && bottom[i + 1].x <= top[j + 1].x))
+            {
+                triangles.push_back(bottom[i].vertex);
+                triangles.push_back(bottom[i + 1].vertex);
+                triangles.push_back(top[j].vertex);
+                i++;
+            }
+            else
+            {
+                triangles.push_back(bottom[i].vertex);
+                triangles.push_back(top[j + 1].vertex);
+                triangles.push_back(top[j].vertex);
+                j++;
+            }
+            result.triangles_count++;
+        }
+    }
+
+    // Outline: the corners strictly inside each edge, after their count. Horizontal edges find them in corners, sorted by
+    // (y, x), vertical ones in corners_by_x, sorted by (x, y)
+    corners_by_x = corners;
+    auto lessByX = [](const rectilinear_corner &a, const rectilinear_corner &b)
+    { return a.x < b.x || (a.x == b.x && a.y < b.y); };
+    std::sort(corners_by_x.begin(), corners_by_x.end(), lessByX);
+
+    const uint32_t outline_begin = (uint32_t)outlines.size();
+    bool split = false;
+    for (uint64_t k = 0; k < points_count; k++)
+    {
+        const Vec2 &p = poly->point_array[k];
+        const Vec2 &q = poly->point_array[k + 1 < points_count ? k + 1 : 0];
+
+        const rectilinear_corner *edge_corners = NULL;
+        uint64_t first = 0;
+        uint64_t last = 0;
+        bool forward = true;
+        if (p.y == q.y && p.x != q.x)
+        {
+            edge_corners = corners.data();
+            first = std::upper_bound(corners.begin(), corners.end(), rectilinear_corner{p.y, std::min(p.x, q.x), 0}) - corners.begin();
+            last = std::lower_bound(corners.begin(), corners.end(), rectilinear_corner{p.y, std::max(p.x, q.x), 0}) - corners.begin();
+            forward = q.x > p.x;
+        }
+        else if (p.x == q.x && p.y != q.y)
+        {
+            edge_corners = corners_by_x.data();
+            first = std::upper_bound(corners_by_x.begin(), corners_by_x.end(), rectilinear_corner{std::min(p.y, q.y), p.x, 0}, lessByX) - corners_by_x.begin();
+            last = std::lower_bound(corners_by_x.begin(), corners_by_x.end(), rectilinear_corner{std::max(p.y, q.y), p.x, 0}, lessByX) - corners_by_x.begin();
+            forward = q.y > p.y;
+        }
+
+        outlines.push_back((uint32_t)(last - first));
+        for (uint64_t i = first; i < last; i++)
+            outlines.push_back(edge_corners[forward ? i : first + last - 1 - i].vertex);
+        split = split || first < last;
+    }
+    if (split)
+    {
+        result.outline_begin = outline_begin;
+        result.outline_count = (uint32_t)(outlines.size() - outline_begin);
+    }
+    else
+    {
+        outlines.resize(outline_begin);
+    }
+
+    result.vertices_count = (uint32_t)(vertices.size() - result.vertices_begin);
+    // Same as the CDT triangles: -1 when the points go counterclockwise
+    if (result.triangles_count > 0)
+        result.orientation = poly->signed_area() > 0 ? -1 : 1;
+
+    polygons.push_back(result);
+}
+
+// CDT::Triangulation can't be reset, so it's still built for each polygon. Its input vectors are reused
+void layer_triangulation::addConstrained(const Polygon *poly)
+{
+    // CDT input, reused by all the polygons
+    thread_local std::vector<CDT::V2d<double>> cdt_vertices;
+    thread_local CDT::EdgeVec cdt_edges;
+    cdt_vertices.clear();
+    cdt_edges.clear();
+
+    const uint64_t points_count = poly->point_array.count;
+    for (uint64_t k = 0; k < points_count; k++)
+    {
+        auto point = poly->point_array[k];
+        cdt_vertices.push_back({point.x, point.y});
+    }
+
+    for (uint64_t k = 0; k < points_count - 1; k++)
+    {
+        cdt_edges.push_back({(CDT::VertInd)k, (CDT::VertInd)k + 1});
+    }
+    // close polygon:
+    cdt_edges.push_back({(CDT::VertInd)points_count - 1, (CDT::VertInd)0});
+
+    CDT::Triangulation<double> cdt(
+        CDT::detail::defaults::vertexInsertionOrder,
+        // CDT::IntersectingConstraintEdges::TryResolve,
+        CDT::IntersectingConstraintEdges::NotAllowed,
+        CDT::detail::defaults::minDistToConstraintEdge);
+
+    CDT::DuplicatesInfo dup_info = CDT::RemoveDuplicatesAndRemapEdges(cdt_vertices, cdt_edges);
+    cdt.insertVertices(cdt_vertices);
+    cdt.insertEdges(cdt_edges);
+    cdt.eraseOuterTrianglesAndHoles();
+
+    polygon result = {};
+    result.points_count = points_count;
+    result.first_point = poly->point_array[0];
+    result.vertices_begin = (uint32_t)vertices.size();
+    result.vertices_count = (uint32_t)cdt.vertices.size();
+    result.triangles_begin = (uint32_t)triangles.size();
+    result.triangles_count = (uint32_t)cdt.triangles.size();
+    result.mapping_begin = NO_MAPPING;
+    result.outline_begin = NO_OUTLINE;
+
+    for (const auto &vertex : cdt.vertices)
+        vertices.push_back({vertex.x, vertex.y});
+
+    for (const auto &triangle : cdt.triangles)
+    {
+        // The winding is taken from the triangles that have an edge between consecutive polygon points
+        int d0 = triangle.vertices[0] - triangle.vertices[1];
+        int d1 = triangle.vertices[1] - triangle.vertices[2];
+        int d2 = triangle.vertices[2] - triangle.vertices[0];
+        if (d0 == 1 || d1 == 1 || d2 == 1)
+            result.orientation = 1;
+        else if (d0 == -1 || d1 == -1 || d2 == -1)
+            result.orientation = -1;
+
+        triangles.push_back(triangle.vertices[0]);
+        triangles.push_back(triangle.vertices[1]);
+        triangles.push_back(triangle.vertices[2]);
+    }
+
+    if (dup_info.duplicates.size() > 0)
+    {
+        result.mapping_begin = (uint32_t)mappings.size();
+        for (uint64_t k = 0; k < points_count; k++)
+            mappings.push_back((uint32_t)dup_info.mapping[k]);
+    }
+
+    polygons.push_back(result);
+}
+
+static std::atomic<uint64_t> g_shape_cache_generation{0};
+
+void shape_triangulation_cache::clearAll()
+{
+    g_shape_cache_generation++;
+}
+
+void shape_triangulation_cache::setStep(double new_step)
+{
+    const uint64_t current_generation = g_shape_cache_generation.load();
+    if (step == new_step && generation == current_generation)
+        return;
+    step = new_step;
+    generation = current_generation;
+    // Swapped with an empty one, clear would keep the buckets allocated
+    std::unordered_map<std::vector<int64_t>, entry, key_hash>().swap(entries);
+}
+
+bool shape_triangulation_cache::find(const Polygon *poly, layer_triangulation &triangulation)
+{
+    key.clear();
+    const uint64_t points_count = poly->point_array.count;
+    if (points_count > MAX_SHAPE_POINTS || step <= 0)
+        return false;
+
+    const Vec2 first = poly->point_array[0];
+    for (uint64_t k = 1; k < points_count; k++)
+    {
+        key.push_back(llround((poly->point_array[k].x - first.x) / step));
+        key.push_back(llround((poly->point_array[k].y - first.y) / step));
+    }
+
+    auto found = entries.find(key);
+    if (found == entries.end())
+    {
+        misses++;
+        return false;
+    }
+    hits++;
+
+    const entry &shape = found->second;
+    layer_triangulation::polygon result = {};
+    result.points_count = points_count;
+    result.first_point = first;
+    result.vertices_begin = (uint32_t)triangulation.vertices.size();
+    result.vertices_count = (uint32_t)shape.vertices.size();
+    result.triangles_begin = (uint32_t)triangulation.triangles.size();
+    result.triangles_count = (uint32_t)shape.triangles.size() / 3;
+    result.mapping_begin = layer_triangulation::NO_MAPPING;
+    result.outline_begin = layer_triangulation::NO_OUTLINE;
+    result.orientation = shape.orientation;
+
+    for (const Vec2 &vertex : shape.vertices)
+        triangulation.vertices.push_back({vertex.x + first.x, vertex.y + first.y});
+    triangulation.triangles.insert(triangulation.triangles.end(), shape.triangles.begin(), shape.triangles.end());
+    if (!shape.mapping.empty())
+    {
+        result.mapping_begin = (uint32_t)triangulation.mappings.size();
+        triangulation.mappings.insert(triangulation.mappings.end(), shape.mapping.begin(), shape.mapping.end());
+    }
+    if (!shape.outline.empty())
+    {
+        result.outline_begin = (uint32_t)triangulation.outlines.size();
+        result.outline_count = (uint32_t)shape.outline.size();
+        triangulation.outlines.insert(triangulation.outlines.end(), shape.outline.begin(), shape.outline.end());
+    }
+
+    triangulation.polygons.push_back(result);
+    return true;
+}
+
+void shape_triangulation_cache::store(const layer_triangulation &triangulation)
+{
+    // Polygons find didn't make a key for
+    if (key.empty())
+        return;
+    if (entries.size() >= MAX_SHAPES)
+        entries.clear();
+
+    const layer_triangulation::polygon &poly = triangulation.polygons.back();
+    entry shape;
+    shape.orientation = poly.orientation;
+    shape.vertices.reserve(poly.vertices_count);
+    for (uint32_t i = 0; i < poly.vertices_count; i++)
+    {
+        const Vec2 &vertex = triangulation.vertices[poly.vertices_begin + i];
+        shape.vertices.push_back({vertex.x - poly.first_point.x, vertex.y - poly.first_point.y});
+    }
+    shape.triangles.assign(triangulation.triangles.begin() + poly.triangles_begin, triangulation.triangles.begin() + poly.triangles_begin + 3 * poly.triangles_count);
+    if (poly.mapping_begin != layer_triangulation::NO_MAPPING)
+        shape.mapping.assign(triangulation.mappings.begin() + poly.mapping_begin, triangulation.mappings.begin() + poly.mapping_begin + poly.points_count);
+    if (poly.outline_begin != layer_triangulation::NO_OUTLINE)
+        shape.outline.assign(triangulation.outlines.begin() + poly.outline_begin, triangulation.outlines.begin() + poly.outline_begin + poly.outline_count);
+
+    entries.emplace(std::move(key), std::move(shape));
+    key.clear();
+}
+
+const layer_triangulation *triangulation_cache::find(uint64_t cell_idx, Tag tag)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = entries.find({cell_idx, tag});
+    return found != entries.end() ? &found->second : NULL;
+}
+
+const layer_triangulation *triangulation_cache::store(uint64_t cell_idx, Tag tag, layer_triangulation &triangulation)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto inserted = entries.emplace(std::make_pair(cell_idx, tag), layer_triangulation());
+    if (inserted.second)
+        inserted.first->second = std::move(triangulation);
+    return &inserted.first->second;
+}
+
+void triangulation_cache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+}
+
+uint64_t triangulation_cache::count()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+uint64_t triangulation_cache::bytes()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t total = 0;
+    for (const auto &entry : entries)
+        total += entry.second.bytes();
+    return total;
+}
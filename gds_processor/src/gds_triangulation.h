@@ -0,0 +1,153 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+#include <gdstk/gdstk.hpp>
+
+// 2D triangulation of the polygons of one (cell, layer) that aren't rectangles. Rectilinear polygons (all edges
+// axis-aligned, most of the routing and standard cell shapes) are split in boxes by a sweep line, the others go through a
+// constrained Delaunay triangulation (CDT).
+// It doesn't depend on the layer z values or the output mode, so it can be kept and extruded again
+struct layer_triangulation
+{
+    struct polygon
+    {
+        // Checked against the polygon the triangulation is used for (see matches)
+        uint64_t points_count;
+        gdstk::Vec2 first_point;
+        // vertices[vertices_begin ..], triangles[triangles_begin .. triangles_begin + 3 * triangles_count)
+        // Without mapping the first points_count vertices are the polygon points, the boxes of a rectilinear polygon add
+        // their other corners after them
+        uint32_t vertices_begin;
+        uint32_t vertices_count;
+        uint32_t triangles_begin;
+        uint32_t triangles_count;
+        // Vertex of each polygon point (mappings[mapping_begin + k]) when the CDT removed duplicated points,
+        // NO_MAPPING when point k is vertex k
+        uint32_t mapping_begin;
+        // When the boxes of a rectilinear polygon put corners in the middle of its edges, the side walls are split at them so
+        // they share the face vertices: for each edge k (point k to k + 1), outlines has the number of corners on it and then
+        // their vertices from point k on (outlines[outline_begin .. outline_begin + outline_count), one wall per entry).
+        // NO_OUTLINE when the walls go from point to point
+        uint32_t outline_begin;
+        uint32_t outline_count;
+        // 1 or -1 depending on the winding of the triangles, 0 without triangles
+        int32_t orientation;
+    };
+    static constexpr uint32_t NO_MAPPING = UINT32_MAX;
+    static constexpr uint32_t NO_OUTLINE = UINT32_MAX;
+
+    std::vector<polygon> polygons;
+    std::vector<gdstk::Vec2> vertices;
+    std::vector<uint32_t> triangles;
+    std::vector<uint32_t> mappings;
+    std::vector<uint32_t> outlines;
+
+    void clear()
+    {
+        polygons.clear();
+        vertices.clear();
+        triangles.clear();
+        mappings.clear();
+        outlines.clear();
+    }
+
+    // Triangulates poly and appends it. Returns true if it was rectilinear (no CDT)
+    bool add(const gdstk::Polygon *poly);
+    void addRectilinear(const gdstk::Polygon *poly);
+    void addConstrained(const gdstk::Polygon *poly);
+
+    // True if polygon i was built from a polygon like poly
+    bool matches(uint64_t i, const gdstk::Polygon *poly) const
+    {
+        return i < polygons.size() && polygons[i].points_count == poly->point_array.count &&
+               polygons[i].first_point.x == poly->point_array[0].x && polygons[i].first_point.y == poly->point_array[0].y;
+    }
+
+    uint64_t bytes() const
+    {
+        return polygons.size() * sizeof(polygon) + vertices.size() * sizeof(gdstk::Vec2) + (triangles.size() + mappings.size() + outlines.size()) * sizeof(uint32_t);
+    }
+};
+
+// Triangulations of single polygons by shape (shape_cache process option): the key is the points relative to the first one,
+// as integer steps of the database precision. A translated copy of a polygon triangulated before (vias, contacts, repeated
+// wire pieces) gets the stored triangulation moved to its first point. Used by one thread, kept across layers and cells
+struct shape_triangulation_cache
+{
+    // Polygons with more points aren't kept, they seldom repeat
+    static constexpr uint64_t MAX_SHAPE_POINTS = 64;
+    // The cache is emptied when it gets more shapes
+    static constexpr uint64_t MAX_SHAPES = 16 * 1024;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    // The shapes of another step, or stored before the last clearAll, are dropped. Called before the lookups of each layer
+    void setStep(double step);
+    // Appends the triangulation of poly from the cache. Returns false if it isn't there, then store can be called
+    // after triangulation.add(poly)
+    bool find(const gdstk::Polygon *poly, layer_triangulation &triangulation);
+    // Keeps the last polygon of triangulation, the one find missed
+    void store(const layer_triangulation &triangulation);
+    // Empties the caches of all the threads (new library, cells emitted again). Each cache is dropped by its thread, in its
+    // next setStep
+    static void clearAll();
+
+private:
+    struct entry
+    {
+        // Relative to the first point of the polygon
+        std::vector<gdstk::Vec2> vertices;
+        std::vector<uint32_t> triangles;
+        std::vector<uint32_t> mapping;
+        std::vector<uint32_t> outline;
+        int32_t orientation;
+    };
+    struct key_hash
+    {
+        size_t operator()(const std::vector<int64_t> &key) const
+        {
+            uint64_t hash = 0xcbf29ce484222325ull;
+            for (int64_t value : key)
+                hash = (hash ^ (uint64_t)value) * 0x100000001b3ull;
+            return (size_t)hash;
+        }
+    };
+
+    double step = 0;
+    // clearAll count this cache was filled after
+    uint64_t generation = 0;
+    // Key of the last find
+    std::vector<int64_t> key;
+    std::unordered_map<std::vector<int64_t>, entry, key_hash> entries;
+};
+
+// Triangulations of each (cell, tag), kept between processCells runs (triangulation_cache process option), so changing the
+// layer stack z values or the output mode only extrudes them again.
+// Entries aren't changed once stored, find and store can be called from any thread
+struct triangulation_cache
+{
+    // Cached triangulation of (cell_idx, tag), or NULL
+    const layer_triangulation *find(uint64_t cell_idx, gdstk::Tag tag);
+    // Moves triangulation into the cache, unless (cell_idx, tag) is already there. Returns the cached one
+    const layer_triangulation *store(uint64_t cell_idx, gdstk::Tag tag, layer_triangulation &triangulation);
+    void clear();
+
+    uint64_t count();
+    uint64_t bytes();
+
+private:
+    struct key_hash
+    {
+        size_t operator()(const std::pair<uint64_t, gdstk::Tag> &key) const
+        {
+            return (size_t)(key.first * 0x9e3779b97f4a7c15ull ^ key.second);
+        }
+    };
+
+    std::mutex mutex;
+    std::unordered_map<std::pair<uint64_t, gdstk::Tag>, layer_triangulation, key_hash> entries;
+};
@@ -60,6 +60,8 @@ let GDS = {
       bounds: bounds,
       is_top_cell: is_top_cell == 1,
       meshes_names: [],
+      // Bounding box meshes shown until the real ones arrive (also in meshes_names)
+      placeholder_meshes_names: [],
       references: [],
       labels: [],
     };
@@ -95,18 +97,156 @@ let GDS = {
     this.cells[parent_cell_name].references.push(reference);
   },
 
-  addMesh: function (cell_name, mesh_name, layer_number, layer_datatype, threejs_mesh) {
+  // Block built by emitCellLabels (see cell_labels_header in gds_processor.h)
+  addCellLabels: function (cell_name, buffer) {
+    const header = new Uint32Array(buffer, 0, 4);
+    const labels_count = header[0];
+    const strings_count = header[1];
+
+    let offset = 16;
+    const positions = new Float32Array(buffer, offset, labels_count * 3);
+    offset += labels_count * 12;
+    const layers = new Uint32Array(buffer, offset, labels_count);
+    offset += labels_count * 4;
+    const texts = new Uint32Array(buffer, offset, labels_count);
+    offset += labels_count * 4;
+    const string_offsets = new Uint32Array(buffer, offset, strings_count + 1);
+    const strings_begin = offset + (strings_count + 1) * 4;
+
+    const decoder = new TextDecoder();
+    const strings = new Array(strings_count);
+    for (let i = 0; i < strings_count; i++) {
+      strings[i] = decoder.decode(
+        new Uint8Array(
+          buffer,
+          strings_begin + string_offsets[i],
+          string_offsets[i + 1] - string_offsets[i],
+        ),
+      );
+    }
+
+    const labels = this.cells[cell_name].labels;
+    for (let i = 0; i < labels_count; i++) {
+      labels.push({
+        text: strings[texts[i]],
+        layer_number: layers[i] & 0xffff,
+        layer_datatype: layers[i] >>> 16,
+        position: new THREE.Vector3(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2]),
+      });
+    }
+  },
+
+  // Table built by processReferencesHierarchy (see references_header and reference_entry in gds_processor.h)
+  // Arrays are expanded here, instance (c, r) at origin + c * v1 + r * v2
+  addReferences: function (buffer) {
+    const header = new Uint32Array(buffer, 0, 4);
+    const strings_count = header[0];
+    const references_count = header[2];
+    const entries_offset = header[3];
+
+    const string_offsets = new Uint32Array(buffer, 16, strings_count + 1);
+    const strings_begin = 16 + (strings_count + 1) * 4;
+    const decoder = new TextDecoder();
+    const strings = new Array(strings_count);
+    for (let i = 0; i < strings_count; i++) {
+      strings[i] = decoder.decode(
+        new Uint8Array(
+          buffer,
+          strings_begin + string_offsets[i],
+          string_offsets[i + 1] - string_offsets[i],
+        ),
+      );
+    }
+
+    // reference_entry: 7 doubles, then 6 uint32 (80 bytes)
+    const entries_f64 = new Float64Array(buffer, entries_offset, references_count * 10);
+    const entries_u32 = new Uint32Array(buffer, entries_offset, references_count * 20);
+    for (let i = 0; i < references_count; i++) {
+      const f = i * 10;
+      const u = i * 20 + 14;
+      const [origin_x, origin_y, rotation, v1_x, v1_y, v2_x, v2_y] = entries_f64.subarray(f, f + 7);
+      const parent_cell_name = strings[entries_u32[u]];
+      const cell_name = strings[entries_u32[u + 1]];
+      const instance_name = strings[entries_u32[u + 2]];
+      const x_reflection = entries_u32[u + 3] != 0;
+      const columns = entries_u32[u + 4];
+      const rows = entries_u32[u + 5];
+
+      for (let c = 0; c < columns; c++) {
+        for (let r = 0; r < rows; r++) {
+          this.addReference(
+            parent_cell_name,
+            cell_name,
+            instance_name,
+            origin_x + c * v1_x + r * v2_x,
+            origin_y + c * v1_y + r * v2_y,
+            rotation,
+            x_reflection,
+          );
+        }
+      }
+    }
+  },
+
+  addMesh: function (
+    cell_name,
+    mesh_name,
+    layer_number,
+    layer_datatype,
+    threejs_mesh,
+    dequantize_matrix = null,
+  ) {
     this.meshes[mesh_name] = {
       layer_number: layer_number,
       layer_datatype: layer_datatype,
       threejs_mesh: threejs_mesh,
+      // Applied before the instance matrices when the mesh positions are quantized
+      dequantize_matrix: dequantize_matrix,
       threejs_lines: null,
       threejs_instanced_mesh: null,
       instances: [],
+      // Coarse levels of detail, sorted from the finest to the coarsest (see updateLevelsOfDetail)
+      lods: [],
+      // Level (0: full detail, l: lods[l - 1]) and slot in that level instanced mesh of each instance
+      instance_levels: null,
+      instance_slots: null,
     };
     this.cells[cell_name].meshes_names.push(mesh_name);
   },
 
+  // Drops the placeholder meshes of the cell (and their instanced meshes, until the scene is built again)
+  removePlaceholders: function (cell_name) {
+    const cell = this.cells[cell_name];
+    if (cell == undefined || cell.placeholder_meshes_names.length == 0) return;
+
+    for (const mesh_name of cell.placeholder_meshes_names) {
+      const mesh = this.meshes[mesh_name];
+      if (mesh.threejs_instanced_mesh != null) {
+        mesh.threejs_instanced_mesh.removeFromParent();
+        mesh.threejs_instanced_mesh.dispose();
+      }
+      mesh.threejs_mesh.geometry.dispose();
+      delete this.meshes[mesh_name];
+    }
+    const placeholders = new Set(cell.placeholder_meshes_names);
+    cell.meshes_names = cell.meshes_names.filter((mesh_name) => !placeholders.has(mesh_name));
+    cell.placeholder_meshes_names = [];
+  },
+
+  addMeshLod: function (mesh_name, threejs_mesh, dequantize_matrix, max_screen_size) {
+    const lods = this.meshes[mesh_name].lods;
+    lods.push({
+      threejs_mesh: threejs_mesh,
+      dequantize_matrix: dequantize_matrix,
+      // Used when the cell takes less pixels than this on screen
+      max_screen_size: max_screen_size,
+      threejs_instanced_mesh: null,
+    });
+    lods.sort(function (a, b) {
+      return b.max_screen_size - a.max_screen_size;
+    });
+  },
+
   addNode: function (cell_name, instance_name, matrix, parent) {
     let node = {
       cell_name: cell_name,
@@ -116,6 +256,10 @@ let GDS = {
       children: [],
       parent: parent,
       instanced_mesh_idx: null,
+      highlighted: false,
+      // Cached by updateLevelsOfDetail
+      screen_size: 0,
+      screen_size_update: -1,
     };
 
     this.nodes.push(node);
@@ -2,24 +2,32 @@ export { WORKER_MSG_TYPE };
 
 const WORKER_MSG_TYPE = {
   WORKER_READY: 'worker_ready',
+  WORKER_ERROR: 'worker_error',
   LOG: 'log',
   STATS: 'stats',
   ADD_CELL: 'add_cell',
-  ADD_MESH: 'add_mesh',
-  ADD_REFERENCE: 'add_reference',
-  ADD_LABEL: 'add_label',
+  ADD_CELL_MESHES: 'add_cell_meshes',
+  ADD_CELL_ALIAS: 'add_cell_alias',
+  ADD_REFERENCES: 'add_references',
+  ADD_CELL_LABELS: 'add_cell_labels',
 
   FINISHED_REFERENCES: 'finished_references',
+  FINISHED_PLACEHOLDERS: 'finished_placeholders',
 
   PROCESS_ENDED: 'process_ended',
+  REGION_PROCESSED: 'region_processed',
+  TRACE: 'trace',
 
   PROCESS_PROGRESS: 'process_progress',
 
   ADD_PROCESS_LAYER: 'add_process_layer',
+  CLEAR_PROCESS_LAYERS: 'clear_process_layers',
+  SET_PROCESS_OPTION: 'set_process_option',
   PROCESS_GDS: 'process_gds',
   PROCESS_CELLS: 'process_cells',
-
-  ADD_LINES: 'add_lines',
+  RESET_PROCESSED_CELLS: 'reset_processed_cells',
+  PROCESS_REGION: 'process_region',
+  WRITE_TRACE: 'write_trace',
 };
 
 if (typeof self !== 'undefined' && typeof self.importScripts === 'function') {
@@ -3,8 +3,32 @@ import gdsProcessorInit from './gds_processor.js';
 
 let ModuleInstance;
 
+// gds_processor exports (EMSCRIPTEN_KEEPALIVE), to detect a wasm built from older sources
+const REQUIRED_EXPORTS = [
+  'processGDS',
+  'processCells',
+  'processRegion',
+  'addProcessLayer',
+  'clearProcessLayers',
+  'resetProcessedCells',
+  'setProcessOption',
+  'writeTrace',
+];
+
 async function initialize() {
   ModuleInstance = await gdsProcessorInit(); // Emscripten initializes the WASM
+
+  const missing_exports = REQUIRED_EXPORTS.filter(
+    (name) => typeof ModuleInstance['_' + name] !== 'function',
+  );
+  if (missing_exports.length > 0) {
+    self.postMessage({
+      type: WORKER_MSG_TYPE.WORKER_ERROR,
+      text: `gds_processor.wasm is out of date (missing ${missing_exports.join(', ')}), rebuild it with npm run build:wasm`,
+    });
+    return;
+  }
+
   self.postMessage({ type: WORKER_MSG_TYPE.WORKER_READY });
   // console.log("wasm module initialized");
 
@@ -13,16 +37,39 @@ async function initialize() {
     if (event.data.type == WORKER_MSG_TYPE.PROCESS_GDS) {
       ModuleInstance.FS.mkdir('/uploaded');
 
-      ModuleInstance.FS.writeFile(event.data.filename, event.data.data);
+      // MEMFS keeps the transferred buffer as the file contents (canOwn), instead of copying it
+      const data = event.data.data;
+      const stream = ModuleInstance.FS.open(event.data.filename, 'w');
+      ModuleInstance.FS.write(stream, data, 0, data.length, 0, true);
+      ModuleInstance.FS.close(stream);
+
       ModuleInstance.ccall(
         'processGDS',
         null,
         ['string', 'number'],
         [event.data.filename, event.data.opt_just_lines ? 1 : 0],
       );
+
+      // The library is in the wasm heap now and the file isn't read again, so its buffer can be released
+      ModuleInstance.FS.unlink(event.data.filename);
     } else if (event.data.type == WORKER_MSG_TYPE.PROCESS_CELLS) {
       ModuleInstance.ccall('processCells', null, ['number'], [event.data.opt_just_lines ? 1 : 0]);
       self.postMessage({ type: WORKER_MSG_TYPE.PROCESS_ENDED });
+    } else if (event.data.type == WORKER_MSG_TYPE.PROCESS_REGION) {
+      const remaining = ModuleInstance.ccall(
+        'processRegion',
+        'number',
+        ['number', 'number', 'number', 'number', 'number', 'number'],
+        [
+          event.data.min_x,
+          event.data.min_y,
+          event.data.max_x,
+          event.data.max_y,
+          event.data.budget,
+          event.data.opt_just_lines ? 1 : 0,
+        ],
+      );
+      self.postMessage({ type: WORKER_MSG_TYPE.REGION_PROCESSED, remaining: remaining });
     } else if (event.data.type == WORKER_MSG_TYPE.ADD_PROCESS_LAYER) {
       ModuleInstance.ccall(
         'addProcessLayer',
@@ -36,6 +83,25 @@ async function initialize() {
           event.data.zmax,
         ],
       );
+    } else if (event.data.type == WORKER_MSG_TYPE.CLEAR_PROCESS_LAYERS) {
+      ModuleInstance.ccall('clearProcessLayers', null, [], []);
+    } else if (event.data.type == WORKER_MSG_TYPE.RESET_PROCESSED_CELLS) {
+      ModuleInstance.ccall('resetProcessedCells', null, [], []);
+    } else if (event.data.type == WORKER_MSG_TYPE.WRITE_TRACE) {
+      // Events recorded with the trace process option, as Chrome trace JSON
+      const trace_filename = '/trace.json';
+      if (ModuleInstance.ccall('writeTrace', 'number', ['string'], [trace_filename])) {
+        const json = ModuleInstance.FS.readFile(trace_filename, { encoding: 'utf8' });
+        ModuleInstance.FS.unlink(trace_filename);
+        self.postMessage({ type: WORKER_MSG_TYPE.TRACE, json: json });
+      }
+    } else if (event.data.type == WORKER_MSG_TYPE.SET_PROCESS_OPTION) {
+      ModuleInstance.ccall(
+        'setProcessOption',
+        null,
+        ['string', 'number'],
+        [event.data.name, event.data.value],
+      );
     }
   };
 
@@ -52,147 +118,76 @@ async function initialize() {
     });
   };
 
-  self.gds_add_lines = (
-    cell_name,
-    mesh_name,
-    layer_number,
-    layer_datatype,
-    positions_count,
-    positions_ptr,
-    indices_count,
-    indices_ptr,
-  ) => {
-    const positionsArray = new Float32Array(
-      ModuleInstance.HEAPF32.buffer,
-      positions_ptr,
-      positions_count,
-    );
-    const indicesArray = new Uint32Array(ModuleInstance.HEAP32.buffer, indices_ptr, indices_count);
-
-    const lines_buffer = new ArrayBuffer(
-      positions_count * Float32Array.BYTES_PER_ELEMENT +
-        indices_count * Uint32Array.BYTES_PER_ELEMENT,
-    );
-    const positionsView = new Float32Array(lines_buffer, 0, positions_count);
-    const indicesView = new Uint32Array(
-      lines_buffer,
-      positions_count * Float32Array.BYTES_PER_ELEMENT,
-      indices_count,
-    );
-
-    positionsView.set(new Float32Array(positionsArray));
-    indicesView.set(new Uint32Array(indicesArray));
+  self.gds_add_cell_meshes = (cell_name, cell_meshes_ptr, cell_meshes_size) => {
+    // All the meshes of the cell are in a single block (see cell_meshes_header in gds_processor.h)
+    // It's copied once out of the wasm heap and then transferred
+    const cell_meshes_buffer = ModuleInstance.HEAPU8.slice(
+      cell_meshes_ptr,
+      cell_meshes_ptr + cell_meshes_size,
+    ).buffer;
 
     self.postMessage(
       {
-        type: WORKER_MSG_TYPE.ADD_LINES,
+        type: WORKER_MSG_TYPE.ADD_CELL_MESHES,
         cell_name: cell_name,
-        mesh_name: mesh_name,
-        layer_number: layer_number,
-        layer_datatype: layer_datatype,
-        positions_offset: 0,
-        positions_count: positions_count,
-        indices_offset: positions_count,
-        indices_count: indices_count,
-        buffer: lines_buffer,
+        buffer: cell_meshes_buffer,
       },
-      [lines_buffer],
+      [cell_meshes_buffer],
     );
   };
 
-  self.gds_add_mesh = (
-    cell_name,
-    mesh_name,
-    layer_number,
-    layer_datatype,
-    positions_count,
-    positions_ptr,
-    indices_count,
-    indices_ptr,
-  ) => {
-    const positionsArray = new Float32Array(
-      ModuleInstance.HEAPF32.buffer,
-      positions_ptr,
-      positions_count,
-    );
-    const indicesArray = new Uint32Array(ModuleInstance.HEAP32.buffer, indices_ptr, indices_count);
-
-    const mesh_buffer = new ArrayBuffer(
-      positions_count * Float32Array.BYTES_PER_ELEMENT +
-        indices_count * Uint32Array.BYTES_PER_ELEMENT,
-    );
-    const positionsView = new Float32Array(mesh_buffer, 0, positions_count);
-    const indicesView = new Uint32Array(
-      mesh_buffer,
-      positions_count * Float32Array.BYTES_PER_ELEMENT,
-      indices_count,
-    );
+  self.gds_add_cell_alias = (cell_name, source_cell_name, offset_x, offset_y) => {
+    self.postMessage({
+      type: WORKER_MSG_TYPE.ADD_CELL_ALIAS,
+      cell_name: cell_name,
+      source_cell_name: source_cell_name,
+      offset_x: offset_x,
+      offset_y: offset_y,
+    });
+  };
 
-    positionsView.set(new Float32Array(positionsArray));
-    indicesView.set(new Uint32Array(indicesArray));
+  self.gds_add_cell_labels = (cell_name, cell_labels_ptr, cell_labels_size) => {
+    // All the labels of the cell are in a single block (see cell_labels_header in gds_processor.h)
+    const cell_labels_buffer = ModuleInstance.HEAPU8.slice(
+      cell_labels_ptr,
+      cell_labels_ptr + cell_labels_size,
+    ).buffer;
 
     self.postMessage(
       {
-        type: WORKER_MSG_TYPE.ADD_MESH,
+        type: WORKER_MSG_TYPE.ADD_CELL_LABELS,
         cell_name: cell_name,
-        mesh_name: mesh_name,
-        layer_number: layer_number,
-        layer_datatype: layer_datatype,
-        positions_offset: 0,
-        positions_count: positions_count,
-        indices_offset: positions_count,
-        indices_count: indices_count,
-        buffer: mesh_buffer,
+        buffer: cell_labels_buffer,
       },
-      [mesh_buffer],
+      [cell_labels_buffer],
     );
   };
 
-  self.gds_add_label = (
-    cell_name,
-    layer_number,
-    layer_datatype,
-    text,
-    origin_x,
-    origin_y,
-    pos_z,
-  ) => {
-    self.postMessage({
-      type: WORKER_MSG_TYPE.ADD_LABEL,
-      cell_name: cell_name,
-      layer_number: layer_number,
-      layer_datatype: layer_datatype,
-      text: text,
-      origin_x: origin_x,
-      origin_y: origin_y,
-      pos_z: pos_z,
-    });
+  self.gds_add_references = (references_ptr, references_size) => {
+    // The references of all the cells are in a single block (see references_header in gds_processor.h)
+    const references_buffer = ModuleInstance.HEAPU8.slice(
+      references_ptr,
+      references_ptr + references_size,
+    ).buffer;
+
+    self.postMessage(
+      {
+        type: WORKER_MSG_TYPE.ADD_REFERENCES,
+        buffer: references_buffer,
+      },
+      [references_buffer],
+    );
   };
 
-  self.gds_add_reference = (
-    parent_cell_name,
-    cell_name,
-    instance_name,
-    origin_x,
-    origin_y,
-    rotation,
-    x_reflection,
-  ) => {
+  self.gds_finished_references = () => {
     self.postMessage({
-      type: WORKER_MSG_TYPE.ADD_REFERENCE,
-      parent_cell_name: parent_cell_name,
-      cell_name: cell_name,
-      instance_name: instance_name,
-      origin_x: origin_x,
-      origin_y: origin_y,
-      rotation: rotation,
-      x_reflection: x_reflection,
+      type: WORKER_MSG_TYPE.FINISHED_REFERENCES,
     });
   };
 
-  self.gds_finished_references = () => {
+  self.gds_finished_placeholders = () => {
     self.postMessage({
-      type: WORKER_MSG_TYPE.FINISHED_REFERENCES,
+      type: WORKER_MSG_TYPE.FINISHED_PLACEHOLDERS,
     });
   };
 
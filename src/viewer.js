@@ -20,6 +20,10 @@ function toHttps(url) {
 const urlParams = new URLSearchParams(location.search);
 const GDS_URL = toHttps(urlParams.get('url') || urlParams.get('model'));
 const GDS_PROCESS = urlParams.get('process') || 'SKY130';
+// ?stream=1: cells are processed by regions, starting with the ones under the camera (see processRegion)
+const STREAM_REGIONS = urlParams.get('stream') == '1';
+// ?trace=1: the processing stages are timed, and the Chrome trace (chrome://tracing, ui.perfetto.dev) is downloaded when it ends
+const TRACE_PROCESS = urlParams.get('trace') == '1';
 const OUTPUT_PROCESS_TO_CONSOLE = false;
 
 if (GDS_URL && GDS_URL.endsWith('.gltf')) {
@@ -74,6 +78,9 @@ let experimental_auto_rotation_speed = 0.01;
 let experimental_separate_layers_level = 0;
 let experimental_separate_layers_target = 0;
 
+let experimental_merge_layers = false;
+let experimental_cull_hidden_faces = false;
+
 // GUI dom elements
 let instanceClassTitleDiv = document.querySelector('div#instanceClassTitle');
 let informationDiv = document.querySelector('div#information');
@@ -132,6 +139,7 @@ let viewSettings, performanceSettings, experimentalSettings;
 
 // Debug FPS stats
 let show_fps_stats = false;
+let levels_of_detail_on = true;
 let fps_stats = new Stats();
 document.body.appendChild(fps_stats.dom);
 fps_stats.domElement.hidden = true;
@@ -161,19 +169,111 @@ gdsProcessorWorker.addEventListener('message', function (event) {
   if (event.data.type == WORKER_MSG_TYPE.WORKER_READY) {
     console.log('WORKER_READY');
     init();
+  } else if (event.data.type == WORKER_MSG_TYPE.WORKER_ERROR) {
+    console.error(event.data.text);
+    loadingStatus.innerText = 'Error initializing the GDS processor';
   } else if (event.data.type == WORKER_MSG_TYPE.LOG) {
     if (OUTPUT_PROCESS_TO_CONSOLE)
       console.log(`Message from gds_processor_worker ${event.data.text}`);
   } else if (event.data.type == WORKER_MSG_TYPE.ADD_CELL) {
     GDS.addCell(event.data.cell_name, event.data.bounds, event.data.is_top_cell);
-  } else if (event.data.type == WORKER_MSG_TYPE.ADD_MESH) {
-    // console.log("ADD_MESH", event.data);
-    let vertices = new Float32Array(event.data.buffer, 0, event.data.positions_count);
-    let indices = new Uint32Array(
-      event.data.buffer,
-      event.data.indices_offset * Float32Array.BYTES_PER_ELEMENT,
-      event.data.indices_count,
+  } else if (event.data.type == WORKER_MSG_TYPE.ADD_CELL_MESHES) {
+    addCellMeshes(event.data.cell_name, event.data.buffer);
+    stream_region.new_cells++;
+    progressive_update.dirty = true;
+  } else if (event.data.type == WORKER_MSG_TYPE.ADD_CELL_ALIAS) {
+    addCellAlias(
+      event.data.cell_name,
+      event.data.source_cell_name,
+      event.data.offset_x,
+      event.data.offset_y,
     );
+    stream_region.new_cells++;
+    progressive_update.dirty = true;
+  } else if (event.data.type == WORKER_MSG_TYPE.ADD_CELL_LABELS) {
+    GDS.addCellLabels(event.data.cell_name, event.data.buffer);
+  } else if (event.data.type == WORKER_MSG_TYPE.ADD_REFERENCES) {
+    GDS.addReferences(event.data.buffer);
+  } else if (event.data.type == WORKER_MSG_TYPE.FINISHED_REFERENCES) {
+    if (STREAM_REGIONS) processRegion(GDS.cells[GDS.top_cells[0]].bounds);
+    else processCells(false);
+  } else if (event.data.type == WORKER_MSG_TYPE.PROCESS_PROGRESS) {
+    // console.log(event.data.progress);
+    // processProgressBar.innerText = Math.round(event.data.progress) + "%";
+    // processProgressBar.value = Math.round(event.data.progress);
+  } else if (event.data.type == WORKER_MSG_TYPE.FINISHED_PLACEHOLDERS) {
+    // First frame, with the placeholders of all the cells
+    progressive_update.active = true;
+    progressive_update.dirty = false;
+    progressive_update.last_time = performance.now();
+    buildScene(null, true);
+    updateGuiAfterLoad();
+    initWindowEvents();
+  } else if (event.data.type == WORKER_MSG_TYPE.PROCESS_ENDED) {
+    if (TRACE_PROCESS) gdsProcessorWorker.postMessage({ type: WORKER_MSG_TYPE.WRITE_TRACE });
+    if (progressive_update.active) {
+      progressive_update.active = false;
+      for (const cell_name in GDS.cells) GDS.removePlaceholders(cell_name);
+      buildScene(GDS.root_node, false);
+    } else {
+      buildScene(null, true);
+      // buildScene(GDS.top_cells[0], true);
+      updateGuiAfterLoad();
+      initWindowEvents();
+    }
+  } else if (event.data.type == WORKER_MSG_TYPE.REGION_PROCESSED) {
+    regionProcessed(event.data.remaining);
+  } else if (event.data.type == WORKER_MSG_TYPE.TRACE) {
+    downloadTrace(event.data.json);
+  }
+});
+
+// Layout of the cell meshes blobs built by processCells (cell_meshes_header and cell_mesh_entry in gds_processor.h)
+const CELL_MESHES_HEADER_SIZE = 40;
+const CELL_MESH_ENTRY_LENGTH = 13;
+const CELL_MESHES_FLAG_LINES = 1;
+const CELL_MESHES_FLAG_QUANTIZED = 2;
+const CELL_MESHES_FLAG_PLACEHOLDER = 4;
+const CELL_MESH_POSITIONS_INT16 = 1;
+const CELL_MESH_POSITIONS_INT32 = 2;
+
+function addCellMeshes(cell_name, buffer) {
+  const header = new Uint32Array(buffer, 0, 4);
+  const meshes_count = header[0];
+  const flags = header[2];
+  // origin_x, origin_y, step
+  const dequantize = new Float64Array(buffer, 16, 3);
+
+  // ToDo: lines (opt_just_lines) aren't displayed yet
+  if (flags & CELL_MESHES_FLAG_LINES) return;
+
+  // The real meshes of a cell replace its placeholders
+  const placeholder = (flags & CELL_MESHES_FLAG_PLACEHOLDER) != 0;
+  if (!placeholder) GDS.removePlaceholders(cell_name);
+
+  const entries = new Uint32Array(
+    buffer,
+    CELL_MESHES_HEADER_SIZE,
+    meshes_count * CELL_MESH_ENTRY_LENGTH,
+  );
+  const entries_float = new Float32Array(
+    buffer,
+    CELL_MESHES_HEADER_SIZE,
+    meshes_count * CELL_MESH_ENTRY_LENGTH,
+  );
+
+  for (let i = 0; i < meshes_count; i++) {
+    const entry = i * CELL_MESH_ENTRY_LENGTH;
+    const layer_number = entries[entry + 0];
+    const layer_datatype = entries[entry + 1];
+    const positions_format = entries[entry + 8];
+    let PositionsArray = Float32Array;
+    if (positions_format == CELL_MESH_POSITIONS_INT16) PositionsArray = Int16Array;
+    else if (positions_format == CELL_MESH_POSITIONS_INT32) PositionsArray = Int32Array;
+    const vertices = new PositionsArray(buffer, entries[entry + 3], entries[entry + 4]);
+    // index_size: uint16 indices when the mesh has less than 65535 vertices
+    const IndicesArray = entries[entry + 7] == 2 ? Uint16Array : Uint32Array;
+    const indices = new IndicesArray(buffer, entries[entry + 5], entries[entry + 6]);
 
     const geometry = new THREE.BufferGeometry();
     geometry.setIndex(new THREE.BufferAttribute(indices, 1));
@@ -182,52 +282,83 @@ gdsProcessorWorker.addEventListener('message', function (event) {
     // ToDo: Check this function. I think is supposed to be defined by us
     geometry.computeBoundingBox();
 
-    const layer_id = GDS.makeLayerId(event.data.layer_number, event.data.layer_datatype);
+    // Quantized positions stay as integers on the GPU, this matrix is applied with each instance matrix
+    // (z is 0 for the zmin level and 1 for zmax)
+    let dequantize_matrix = null;
+    if (flags & CELL_MESHES_FLAG_QUANTIZED) {
+      const zmin = entries_float[entry + 9];
+      const zmax = entries_float[entry + 10];
+      dequantize_matrix = new THREE.Matrix4()
+        .makeTranslation(dequantize[0], dequantize[1], zmin)
+        .multiply(new THREE.Matrix4().makeScale(dequantize[2], dequantize[2], zmax - zmin));
+    }
+
+    const layer_id = GDS.makeLayerId(layer_number, layer_datatype);
     if (GDS.layers[layer_id] == undefined) {
-      console.error(
-        `ADD_MESH error: layer ${event.data.layer_number}/${event.data.layer_datatype} not found`,
-      );
+      console.error(`ADD_CELL_MESHES error: layer ${layer_number}/${layer_datatype} not found`);
+      continue;
+    }
+    const layer = GDS.layers[layer_id];
+    const mesh = new THREE.Mesh(geometry, layer.threejs_material);
+    const mesh_name = `${cell_name}_${layer.name}`;
+
+    // Coarse levels of detail come after the full detail mesh of their layer
+    const lod_level = entries[entry + 11];
+    if (lod_level > 0) {
+      mesh.name = `${mesh_name}_lod${lod_level}`;
+      GDS.addMeshLod(mesh_name, mesh, dequantize_matrix, entries_float[entry + 12]);
+      continue;
     }
-    const material = GDS.layers[layer_id].threejs_material;
-    const mesh = new THREE.Mesh(geometry, material);
-    mesh.name = event.data.mesh_name;
 
+    mesh.name = placeholder ? `${mesh_name}_placeholder` : mesh_name;
+    GDS.addMesh(cell_name, mesh.name, layer_number, layer_datatype, mesh, dequantize_matrix);
+    if (placeholder) GDS.cells[cell_name].placeholder_meshes_names.push(mesh.name);
+  }
+}
+
+// The cell has the shapes of source_cell_name moved by offset: its meshes use the source geometries
+// (the same GPU buffers), with their own instanced meshes so the cell can still be hidden or highlighted
+function addCellAlias(cell_name, source_cell_name, offset_x, offset_y) {
+  GDS.removePlaceholders(cell_name);
+
+  const source = GDS.cells[source_cell_name];
+  const offset_matrix = new THREE.Matrix4().makeTranslation(offset_x, offset_y, 0);
+  const aliasMatrix = (dequantize_matrix) => {
+    if (dequantize_matrix) return offset_matrix.clone().multiply(dequantize_matrix);
+    return offset_x != 0 || offset_y != 0 ? offset_matrix.clone() : null;
+  };
+
+  for (const source_mesh_name of source.meshes_names) {
+    if (source.placeholder_meshes_names.includes(source_mesh_name)) continue;
+
+    const source_mesh = GDS.meshes[source_mesh_name];
+    const layer = GDS.layers[GDS.makeLayerId(source_mesh.layer_number, source_mesh.layer_datatype)];
+    const mesh_name = `${cell_name}_${layer.name}`;
+    const mesh = new THREE.Mesh(source_mesh.threejs_mesh.geometry, layer.threejs_material);
+    mesh.name = mesh_name;
     GDS.addMesh(
-      event.data.cell_name,
-      event.data.mesh_name,
-      event.data.layer_number,
-      event.data.layer_datatype,
+      cell_name,
+      mesh_name,
+      source_mesh.layer_number,
+      source_mesh.layer_datatype,
       mesh,
+      aliasMatrix(source_mesh.dequantize_matrix),
     );
-  } else if (event.data.type == WORKER_MSG_TYPE.ADD_REFERENCE) {
-    GDS.addReference(
-      event.data.parent_cell_name,
-      event.data.cell_name,
-      event.data.instance_name,
-      event.data.origin_x,
-      event.data.origin_y,
-      event.data.rotation,
-      event.data.x_reflection,
-    );
-  } else if (event.data.type == WORKER_MSG_TYPE.FINISHED_REFERENCES) {
-    processCells(false);
-  } else if (event.data.type == WORKER_MSG_TYPE.PROCESS_PROGRESS) {
-    // console.log(event.data.progress);
-    // processProgressBar.innerText = Math.round(event.data.progress) + "%";
-    // processProgressBar.value = Math.round(event.data.progress);
-  } else if (event.data.type == WORKER_MSG_TYPE.PROCESS_ENDED) {
-    buildScene(null, true);
-    // buildScene(GDS.top_cells[0], true);
-    updateGuiAfterLoad();
-    initWindowEvents();
+
+    source_mesh.lods.forEach((lod, i) => {
+      const lod_mesh = new THREE.Mesh(lod.threejs_mesh.geometry, layer.threejs_material);
+      lod_mesh.name = `${mesh_name}_lod${i + 1}`;
+      GDS.addMeshLod(mesh_name, lod_mesh, aliasMatrix(lod.dequantize_matrix), lod.max_screen_size);
+    });
   }
-});
+}
 
 function init() {
   performanceSettings = {
     logarithmicDepthBuffer: false,
     antialias: true,
     'Show FPS': show_fps_stats,
+    'Levels of detail': levels_of_detail_on,
   };
 
   experimentalSettings = {
@@ -237,6 +368,8 @@ function init() {
     'Auto rotation': experimental_auto_rotation,
     'Rotation speed': experimental_auto_rotation_speed,
     'Separate layers': experimental_separate_layers_level,
+    'Merge layers (next load)': experimental_merge_layers,
+    'Cull hidden faces (next load)': experimental_cull_hidden_faces,
   };
 
   viewSettings = {
@@ -254,6 +387,7 @@ function init() {
   initGUI();
 
   initProcessLayers();
+  initProcessOptions();
 
   if (GDS_URL) {
     loadGDS(GDS_URL);
@@ -333,6 +467,108 @@ function processCells() {
   gdsProcessorWorker.postMessage({ type: WORKER_MSG_TYPE.PROCESS_CELLS, opt_just_lines: false });
 }
 
+// Progressive emission
+// The scene is built first with the placeholders of all the cells (FINISHED_PLACEHOLDERS), then rebuilt with the real
+// meshes received so far, at most once every PROGRESSIVE_UPDATE_MS, until PROCESS_ENDED
+const PROGRESSIVE_UPDATE_MS = 1000;
+let progressive_update = {
+  active: false,
+  dirty: false,
+  last_time: 0,
+};
+
+function updateProgressiveScene() {
+  if (!progressive_update.active || !progressive_update.dirty) return;
+
+  const now = performance.now();
+  if (now - progressive_update.last_time < PROGRESSIVE_UPDATE_MS) return;
+  progressive_update.dirty = false;
+  progressive_update.last_time = now;
+
+  buildScene(GDS.root_node, false);
+}
+
+// Region streaming
+// The first region is the whole top cell, then the region seen by the camera is requested again when the camera moved
+// or the last one still had cells left, at most once every STREAM_UPDATE_MS. Each request processes cells holding up to
+// STREAM_REGION_BUDGET shapes, and the scene is rebuilt when new cells arrived
+const STREAM_REGION_BUDGET = 200000;
+const STREAM_UPDATE_MS = 500;
+let stream_region = {
+  loaded: false,
+  pending: false,
+  remaining: 0,
+  new_cells: 0,
+  last_time: 0,
+  camera_matrix: new THREE.Matrix4(),
+};
+const stream_ray = new THREE.Ray();
+const stream_plane = new THREE.Plane(new THREE.Vector3(0, 0, 1), 0);
+const stream_point = new THREE.Vector3();
+
+function processRegion(region) {
+  stream_region.pending = true;
+  stream_region.new_cells = 0;
+  gdsProcessorWorker.postMessage({
+    type: WORKER_MSG_TYPE.PROCESS_REGION,
+    min_x: region.min_x,
+    min_y: region.min_y,
+    max_x: region.max_x,
+    max_y: region.max_y,
+    budget: STREAM_REGION_BUDGET,
+    opt_just_lines: false,
+  });
+}
+
+function regionProcessed(remaining) {
+  stream_region.pending = false;
+  stream_region.remaining = remaining;
+  if (!stream_region.loaded) {
+    stream_region.loaded = true;
+    buildScene(null, true);
+    updateGuiAfterLoad();
+    initWindowEvents();
+  } else if (stream_region.new_cells > 0) {
+    buildScene(GDS.root_node, false);
+  }
+}
+
+// Rectangle of the z = 0 plane seen by the camera, or the top cell bounds when the view reaches the horizon
+function cameraViewRegion() {
+  const bounds = GDS.cells[GDS.top_cells[0]].bounds;
+  let region = { min_x: Infinity, min_y: Infinity, max_x: -Infinity, max_y: -Infinity };
+  for (const [x, y] of [
+    [-1, -1],
+    [1, -1],
+    [1, 1],
+    [-1, 1],
+  ]) {
+    stream_point.set(x, y, 0.5).unproject(camera);
+    stream_ray.origin.copy(camera.position);
+    stream_ray.direction.copy(stream_point).sub(camera.position).normalize();
+    if (stream_ray.intersectPlane(stream_plane, stream_point) == null) return bounds;
+
+    region.min_x = Math.min(region.min_x, stream_point.x);
+    region.min_y = Math.min(region.min_y, stream_point.y);
+    region.max_x = Math.max(region.max_x, stream_point.x);
+    region.max_y = Math.max(region.max_y, stream_point.y);
+  }
+  return region;
+}
+
+function updateStreamRegion() {
+  if (!STREAM_REGIONS || !stream_region.loaded || stream_region.pending) return;
+
+  const now = performance.now();
+  const camera_moved = !stream_region.camera_matrix.equals(camera.matrixWorld);
+  if (!camera_moved && stream_region.remaining == 0) return;
+  if (now - stream_region.last_time < STREAM_UPDATE_MS) return;
+  stream_region.last_time = now;
+  stream_region.camera_matrix.copy(camera.matrixWorld);
+
+  processRegion(cameraViewRegion());
+}
+
 function initProcessLayers() {
   // const process_layers = PROCESS_LAYERS.SG13G2;
   const process_layers = PROCESS_LAYERS[GDS_PROCESS];
@@ -361,6 +597,39 @@ function initProcessLayers() {
   }
 }
 
+function setProcessOption(name, value) {
+  gdsProcessorWorker.postMessage({
+    type: WORKER_MSG_TYPE.SET_PROCESS_OPTION,
+    name: name,
+    value: value,
+  });
+}
+
+function initProcessOptions() {
+  // Threads need SharedArrayBuffer, only available when the page is cross-origin isolated
+  // (and a gds_processor build with GDS_PROCESSOR_THREADS)
+  const threads = self.crossOriginIsolated ? navigator.hardwareConcurrency || 1 : 1;
+  setProcessOption('threads', threads);
+  setProcessOption('shared_vertices', 1);
+  setProcessOption('quantized_positions', 1);
+  setProcessOption('lod_levels', 2);
+  setProcessOption('progressive_emission', 1);
+  // Files are processed again from the start, cells are never emitted twice
+  setProcessOption('release_geometry', 1);
+  setProcessOption('alias_identical_cells', 1);
+  setProcessOption('shape_cache', 1);
+  if (TRACE_PROCESS) setProcessOption('trace', 1);
+}
+
+function downloadTrace(json) {
+  const url = URL.createObjectURL(new Blob([json], { type: 'application/json' }));
+  const link = document.createElement('a');
+  link.href = url;
+  link.download = 'gds_processor_trace.json';
+  link.click();
+  URL.revokeObjectURL(url);
+}
+
 async function fetchWithProgressArrayBuffer(url) {
   try {
     const response = await fetch(url);
@@ -576,6 +845,12 @@ function initGUI() {
     show_fps_stats = new_value;
     fps_stats.domElement.hidden = !show_fps_stats;
   });
+  guiPerformanceSettings
+    .add(performanceSettings, 'Levels of detail')
+    .onChange(function (new_value) {
+      levels_of_detail_on = new_value;
+      lods_update.dirty = true;
+    });
 
   // Experimental Settings
   guiExperimentalSettings.add(experimentalSettings, 'Show section').onChange(function (new_value) {
@@ -606,6 +881,18 @@ function initGUI() {
     .onChange(function (new_value) {
       experimental_separate_layers_target = new_value;
     });
+  guiExperimentalSettings
+    .add(experimentalSettings, 'Merge layers (next load)')
+    .onChange(function (new_value) {
+      experimental_merge_layers = new_value;
+      setProcessOption('merge_layers', new_value ? 1 : 0);
+    });
+  guiExperimentalSettings
+    .add(experimentalSettings, 'Cull hidden faces (next load)')
+    .onChange(function (new_value) {
+      experimental_cull_hidden_faces = new_value;
+      setProcessOption('cull_hidden_faces', new_value ? 1 : 0);
+    });
 }
 
 function updateGuiAfterLoad() {
@@ -742,9 +1029,17 @@ function animate() {
       const layer_order =
         GDS.layers[GDS.makeLayerId(mesh.layer_number, mesh.layer_datatype)].visual_order;
       mesh.threejs_instanced_mesh.position.z = experimental_separate_layers_level * layer_order;
+      for (const lod of mesh.lods) {
+        if (lod.threejs_instanced_mesh != null)
+          lod.threejs_instanced_mesh.position.z = experimental_separate_layers_level * layer_order;
+      }
     }
   }
 
+  updateLevelsOfDetail();
+  updateStreamRegion();
+  updateProgressiveScene();
+
   // B&W mode
   if (!experimental_bw_mode_on) {
     scene.background = new THREE.Color(0x606060);
@@ -765,12 +1060,18 @@ function animate() {
   if (show_fps_stats) fps_stats.update();
 }
 
+function setMeshVisibility(mesh, visible) {
+  if (mesh.threejs_instanced_mesh != null) mesh.threejs_instanced_mesh.visible = visible;
+  for (const lod of mesh.lods) {
+    if (lod.threejs_instanced_mesh != null) lod.threejs_instanced_mesh.visible = visible;
+  }
+}
+
 function setCellVisibility(cell_name, visible) {
   const meshes_names = GDS.cells[cell_name].meshes_names;
 
   for (let i = 0; i < meshes_names.length; i++) {
-    if (GDS.meshes[meshes_names[i]].threejs_instanced_mesh != null)
-      GDS.meshes[meshes_names[i]].threejs_instanced_mesh.visible = visible;
+    setMeshVisibility(GDS.meshes[meshes_names[i]], visible);
   }
 }
 
@@ -815,7 +1116,7 @@ function setTopCellGeometryVisibility(visible) {
   for (let i = 0; i < cell.meshes_names.length; i++) {
     const mesh = GDS.meshes[cell.meshes_names[i]];
     const layer_name = GDS.layers[GDS.makeLayerId(mesh.layer_number, mesh.layer_datatype)].name;
-    if (layer_name != 'substrate') mesh.threejs_instanced_mesh.visible = visible;
+    if (layer_name != 'substrate') setMeshVisibility(mesh, visible);
   }
 
   // for (var i = 0; i < GDS.root_node.children.length; i++) {
@@ -1094,32 +1395,53 @@ function zoomSelection() {
   }
 }
 
+// Instanced mesh and index in it where an instance of the mesh is drawn (it changes with the instance level of detail)
+function getInstanceSlot(mesh, instance_idx) {
+  if (mesh.instance_levels == null) {
+    return { instanced_mesh: mesh.threejs_instanced_mesh, slot: instance_idx };
+  }
+  const level = mesh.instance_levels[instance_idx];
+  return {
+    instanced_mesh:
+      level == 0 ? mesh.threejs_instanced_mesh : mesh.lods[level - 1].threejs_instanced_mesh,
+    slot: mesh.instance_slots[instance_idx],
+  };
+}
+
 function highlightObject(graph_node) {
   highlighted_objects.push(graph_node);
+  graph_node.highlighted = true;
 
   const cell = GDS.cells[graph_node.cell_name];
 
   for (let i = 0; i < cell.meshes_names.length; i++) {
     const color = new THREE.Color();
-    const instancedMesh = GDS.meshes[cell.meshes_names[i]].threejs_instanced_mesh;
+    const { instanced_mesh, slot } = getInstanceSlot(
+      GDS.meshes[cell.meshes_names[i]],
+      graph_node.instanced_mesh_idx,
+    );
 
-    instancedMesh.getColorAt(graph_node.instanced_mesh_idx, color);
+    instanced_mesh.getColorAt(slot, color);
     highlighted_prev_colors.push(color.clone());
 
-    instancedMesh.setColorAt(graph_node.instanced_mesh_idx, highlight_color);
-    instancedMesh.instanceColor.needsUpdate = true;
+    instanced_mesh.setColorAt(slot, highlight_color);
+    instanced_mesh.instanceColor.needsUpdate = true;
   }
 }
 
 function turnOffHighlight() {
   for (let i = 0; i < highlighted_objects.length; i++) {
     const graph_node = highlighted_objects[i];
+    graph_node.highlighted = false;
 
     const cell = GDS.cells[graph_node.cell_name];
     for (let i = 0; i < cell.meshes_names.length; i++) {
-      const instancedMesh = GDS.meshes[cell.meshes_names[i]].threejs_instanced_mesh;
-      instancedMesh.setColorAt(graph_node.instanced_mesh_idx, highlighted_prev_colors[i].clone());
-      instancedMesh.instanceColor.needsUpdate = true;
+      const { instanced_mesh, slot } = getInstanceSlot(
+        GDS.meshes[cell.meshes_names[i]],
+        graph_node.instanced_mesh_idx,
+      );
+      instanced_mesh.setColorAt(slot, highlighted_prev_colors[i].clone());
+      instanced_mesh.instanceColor.needsUpdate = true;
     }
   }
   highlighted_objects = [];
@@ -1179,6 +1501,7 @@ window.onresize = function () {
   camera.aspect = window.innerWidth / window.innerHeight;
   camera.updateProjectionMatrix();
   renderer.setSize(window.innerWidth, window.innerHeight);
+  lods_update.dirty = true;
 };
 
 function initWindowEvents() {
@@ -1287,6 +1610,9 @@ function initWindowEvents() {
         if (intersections[i].object.isInstancedMesh && intersections[i].object.visible) {
           let mesh = intersections[i].object;
           let instanceId = intersections[i].instanceId;
+          // With levels of detail the slots of the instanced meshes are regrouped
+          const instances_order = mesh.userData.instances;
+          if (instances_order) instanceId = instances_order[instanceId];
 
           let clicked_node = GDS.meshes[mesh.name].instances[instanceId].node;
 
@@ -1327,8 +1653,14 @@ function cleanScene() {
     if (mesh.threejs_lines != null) mesh.threejs_lines.geometry.dispose();
 
     if (mesh.threejs_instanced_mesh != null) mesh.threejs_instanced_mesh.dispose();
+    for (const lod of mesh.lods) {
+      if (lod.threejs_instanced_mesh != null) lod.threejs_instanced_mesh.dispose();
+      lod.threejs_instanced_mesh = null;
+    }
 
     mesh.instances = [];
+    mesh.instance_levels = null;
+    mesh.instance_slots = null;
   }
 
   if (scene_root_group != undefined) {
@@ -1366,16 +1698,19 @@ function buildSceneDoNodeCalcs(node, parent_matrix) {
     let mesh_bounding_box;
     const mesh_name = cell.meshes_names[j];
 
+    const dequantize_matrix = GDS.meshes[mesh_name].dequantize_matrix;
     let instance_data = {
       name: mesh_name,
-      matrix: node_matrix,
+      matrix: dequantize_matrix ? node_matrix.clone().multiply(dequantize_matrix) : node_matrix,
+      // The coarse levels of detail have their own dequantize matrix
+      node_matrix: node_matrix,
       node: node,
     };
 
     GDS.meshes[mesh_name].instances.push(instance_data);
 
     mesh_bounding_box = GDS.meshes[mesh_name].threejs_mesh.geometry.boundingBox.clone();
-    mesh_bounding_box.applyMatrix4(node_matrix);
+    mesh_bounding_box.applyMatrix4(instance_data.matrix);
 
     if (node.scene_bounding_box == null) {
       node.scene_bounding_box = mesh_bounding_box.clone();
@@ -1430,9 +1765,10 @@ function buildMeshesScene(top_node, main_matrix) {
       mesh.instances.length,
     );
 
-    instanced_mesh.layers.set(
-      getTHREEJSLayerFromGDSLayerId(GDS.makeLayerId(mesh.layer_number, mesh.layer_datatype)),
+    const threejs_layer = getTHREEJSLayerFromGDSLayerId(
+      GDS.makeLayerId(mesh.layer_number, mesh.layer_datatype),
     );
+    instanced_mesh.layers.set(threejs_layer);
 
     instanced_mesh.name = reference_mesh.name;
 
@@ -1457,9 +1793,138 @@ function buildMeshesScene(top_node, main_matrix) {
 
     scene_root_group.add(instanced_mesh);
     mesh.threejs_instanced_mesh = instanced_mesh;
+
+    // Levels of detail start empty, updateLevelsOfDetail moves the instances that are small on screen to them
+    if (mesh.lods.length > 0) {
+      mesh.instance_levels = new Uint8Array(mesh.instances.length);
+      mesh.instance_slots = new Uint32Array(mesh.instances.length);
+      for (let j = 0; j < mesh.instances.length; j++) mesh.instance_slots[j] = j;
+      instanced_mesh.userData.instances = mesh.instance_slots.slice();
+
+      for (const lod of mesh.lods) {
+        const lod_instanced_mesh = new THREE.InstancedMesh(
+          lod.threejs_mesh.geometry,
+          lod.threejs_mesh.material,
+          mesh.instances.length,
+        );
+        lod_instanced_mesh.layers.set(threejs_layer);
+        lod_instanced_mesh.name = mesh_name;
+        lod_instanced_mesh.count = 0;
+        lod_instanced_mesh.userData.instances = new Uint32Array(mesh.instances.length);
+
+        scene_root_group.add(lod_instanced_mesh);
+        lod.threejs_instanced_mesh = lod_instanced_mesh;
+      }
+    }
   }
 
   scene.add(scene_root_group);
+  lods_update.dirty = true;
+}
+
+// Levels of detail
+// Each instance of a mesh with coarse levels is drawn by the instanced mesh of the level chosen from the size of its node
+// on screen. Instances are regrouped when the camera moved, at most once every LODS_UPDATE_MS
+const LODS_UPDATE_MS = 200;
+let lods_update = {
+  dirty: true,
+  last_time: 0,
+  count: 0,
+  camera_matrix: new THREE.Matrix4(),
+};
+const lod_size = new THREE.Vector3();
+const lod_center = new THREE.Vector3();
+const lod_matrix = new THREE.Matrix4();
+const lod_default_color = new THREE.Color(1, 1, 1);
+
+// Larger side of the node bounding box in pixels (computed once per update)
+function nodeScreenSize(node, pixels_per_unit) {
+  if (node.screen_size_update != lods_update.count) {
+    node.screen_size_update = lods_update.count;
+    node.scene_bounding_box.getSize(lod_size);
+    node.scene_bounding_box.getCenter(lod_center);
+    const distance = Math.max(lod_center.distanceTo(camera.position), camera.near);
+    node.screen_size = (Math.max(lod_size.x, lod_size.y) * pixels_per_unit) / distance;
+  }
+  return node.screen_size;
+}
+
+function updateMeshLevelsOfDetail(mesh, pixels_per_unit) {
+  const instances = mesh.instances;
+  const levels = mesh.instance_levels;
+
+  let changed = false;
+  for (let j = 0; j < instances.length; j++) {
+    let level = 0;
+    if (levels_of_detail_on) {
+      const screen_size = nodeScreenSize(instances[j].node, pixels_per_unit);
+      while (level < mesh.lods.length && screen_size < mesh.lods[level].max_screen_size) level++;
+    }
+    if (levels[j] != level) {
+      levels[j] = level;
+      changed = true;
+    }
+  }
+  if (!changed) return;
+
+  const instanced_meshes = [mesh.threejs_instanced_mesh];
+  for (const lod of mesh.lods) instanced_meshes.push(lod.threejs_instanced_mesh);
+  const counts = new Array(instanced_meshes.length).fill(0);
+
+  for (let j = 0; j < instances.length; j++) {
+    const level = levels[j];
+    const instanced_mesh = instanced_meshes[level];
+    const slot = counts[level]++;
+
+    let matrix = instances[j].matrix;
+    if (level > 0) {
+      const dequantize_matrix = mesh.lods[level - 1].dequantize_matrix;
+      matrix = dequantize_matrix
+        ? lod_matrix.multiplyMatrices(instances[j].node_matrix, dequantize_matrix)
+        : instances[j].node_matrix;
+    }
+    instanced_mesh.setMatrixAt(slot, matrix);
+    instanced_mesh.setColorAt(
+      slot,
+      instances[j].node.highlighted ? highlight_color : lod_default_color,
+    );
+    instanced_mesh.userData.instances[slot] = j;
+    mesh.instance_slots[j] = slot;
+  }
+
+  for (let level = 0; level < instanced_meshes.length; level++) {
+    const instanced_mesh = instanced_meshes[level];
+    instanced_mesh.count = counts[level];
+    instanced_mesh.instanceMatrix.needsUpdate = true;
+    if (instanced_mesh.instanceColor) instanced_mesh.instanceColor.needsUpdate = true;
+    // Recomputed from the instances for frustum culling and raycasting
+    instanced_mesh.boundingSphere = null;
+    instanced_mesh.boundingBox = null;
+  }
+}
+
+function updateLevelsOfDetail() {
+  if (GDS.root_node == null) return;
+
+  const now = performance.now();
+  if (!lods_update.dirty) {
+    if (lods_update.camera_matrix.equals(camera.matrixWorld)) return;
+    if (now - lods_update.last_time < LODS_UPDATE_MS) return;
+  }
+  lods_update.dirty = false;
+  lods_update.last_time = now;
+  lods_update.camera_matrix.copy(camera.matrixWorld);
+  lods_update.count++;
+
+  const pixels_per_unit =
+    renderer.domElement.clientHeight / (2 * Math.tan(THREE.MathUtils.degToRad(camera.fov) / 2));
+
+  for (const mesh_name in GDS.meshes) {
+    const mesh = GDS.meshes[mesh_name];
+    if (mesh.instance_levels != null && mesh.threejs_instanced_mesh != null) {
+      updateMeshLevelsOfDetail(mesh, pixels_per_unit);
+    }
+  }
 }
 
 function buildScene(node, reset_camera = true) {